@@ -4,55 +4,207 @@ const binding = require('./build/Release/taglib3.node')
 const AsyncLock = require('async-lock')
 const lock = new AsyncLock({ timeout: 60000 })
 
+const EventEmitter = require('events')
+
 // for some reason, the binding only works reliably with absolute paths
 const resolve = require('path').resolve
 
-exports.writeTags = (path, options, callback) => {
+// run an async binding call under the file lock, honouring options.signal and options.timeout
+// the deadline includes the time spent waiting for other operations on the same file
+// an aborted or expired read is settled right away, while the lock is only released once
+// the native job has really finished
+// a write which has reached the native side reports its real outcome instead, as it may already be saving
+const run = (path, options, job, callback, write = false) => {
+  const signal = options.signal
+  const deadline = options.timeout > 0 ? Date.now() + options.timeout : 0
+  let id = null
+  let settled = false
+  let timer = null
+
+  const settle = (error, data) => {
+    if (settled) {
+      return
+    }
+    settled = true
+    clearTimeout(timer)
+    if (signal) {
+      signal.removeEventListener('abort', onAbort)
+    }
+    callback(error, data)
+  }
+
+  // settle from JS, the native flag makes a job which has not finished yet return right away
+  const cancel = (reason) => {
+    if (id !== null) {
+      binding.abort(id)
+    }
+    if (id === null || !write) {
+      settle(reason)
+    }
+  }
+
+  const onAbort = () => cancel('Operation aborted')
+
+  if (signal) {
+    if (signal.aborted) {
+      process.nextTick(settle, 'Operation aborted')
+      return
+    }
+    signal.addEventListener('abort', onAbort)
+  }
+
+  // a native write expires on its own at the same deadline
+  if (deadline) {
+    timer = setTimeout(() => {
+      if (id === null || !write) {
+        cancel('Operation timed out')
+      }
+    }, options.timeout)
+  }
+
+  lock.acquire(path, (done) => {
+    if (settled) {
+      return done()
+    }
+
+    const timeout = deadline - Date.now()
+    id = job(Object.assign({}, options, { timeout: deadline ? Math.max(timeout, 1) : 0 }), (error, data) => {
+      done()
+      settle(error, data)
+    })
+  }, (error) => {
+    if (error) {
+      settle(error)
+    }
+  })
+}
+
+exports.writeTags = (path, options, opts, callback) => {
+  if (typeof opts === 'function') {
+    callback = opts
+    opts = {}
+  }
   path = resolve(path)
-  return lock.acquire(path, (cb) => binding.writeTags(path, options, cb), callback)
+  return run(path, opts, (o, cb) => binding.writeTags(path, options, o, cb), callback, true)
 }
 
-exports.writeTagsSync = (path, options) => {
+exports.writeTagsSync = (path, options, opts = {}) => {
   path = resolve(path)
-  return binding.writeTagsSync(path, options)
+  return binding.writeTagsSync(path, options, opts)
 }
 
-exports.writeId3Tags = (path, options, callback) => {
+exports.writeId3Tags = (path, options, opts, callback) => {
+  if (typeof opts === 'function') {
+    callback = opts
+    opts = {}
+  }
   path = resolve(path)
-  return lock.acquire(path, (cb) => binding.writeId3Tags(path, options, cb), callback)
+  return run(path, opts, (o, cb) => binding.writeId3Tags(path, options, o, cb), callback, true)
 }
 
-exports.writeId3TagsSync = (path, options) => {
+exports.writeId3TagsSync = (path, options, opts = {}) => {
   path = resolve(path)
-  return binding.writeId3TagsSync(path, options)
+  return binding.writeId3TagsSync(path, options, opts)
 }
 
-exports.readTags = (path, callback) => {
+exports.readTags = (path, opts, callback) => {
+  if (typeof opts === 'function') {
+    callback = opts
+    opts = {}
+  }
   path = resolve(path)
-  return lock.acquire(path, (cb) => binding.readTags(path, cb), callback)
+  return run(path, opts, (o, cb) => binding.readTags(path, o, cb), callback)
 }
 
-exports.readTagsSync = path => {
+exports.readTagsSync = (path, opts = {}) => {
   path = resolve(path)
-  return binding.readTagsSync(path)
+  return binding.readTagsSync(path, opts)
 }
 
-exports.readId3Tags = (path, callback) => {
+exports.readTagsBounded = (path, opts, callback) => {
+  if (typeof opts === 'function') {
+    callback = opts
+    opts = {}
+  }
   path = resolve(path)
-  return lock.acquire(path, (cb) => binding.readId3Tags(path, cb), callback)
+  return run(path, opts, (o, cb) => binding.readTagsBounded(path, o, cb), callback)
 }
 
-exports.readId3TagsSync = path => {
+exports.readTagsBoundedSync = (path, opts = {}) => {
   path = resolve(path)
-  return binding.readId3TagsSync(path)
+  return binding.readTagsBoundedSync(path, opts)
 }
 
-exports.readAudioProperties = (path, callback) => {
+exports.readId3Tags = (path, opts, callback) => {
+  if (typeof opts === 'function') {
+    callback = opts
+    opts = {}
+  }
   path = resolve(path)
-  return lock.acquire(path, (cb) => binding.readAudioProperties(path, cb), callback)
+  return run(path, opts, (o, cb) => binding.readId3Tags(path, o, cb), callback)
 }
 
-exports.readAudioPropertiesSync = path => {
+exports.readId3TagsSync = (path, opts = {}) => {
   path = resolve(path)
-  return binding.readAudioPropertiesSync(path)
+  return binding.readId3TagsSync(path, opts)
+}
+
+exports.readAudioProperties = (path, opts, callback) => {
+  if (typeof opts === 'function') {
+    callback = opts
+    opts = {}
+  }
+  path = resolve(path)
+  return run(path, opts, (o, cb) => binding.readAudioProperties(path, o, cb), callback)
+}
+
+exports.readAudioPropertiesSync = (path, opts = {}) => {
+  path = resolve(path)
+  return binding.readAudioPropertiesSync(path, opts)
+}
+
+exports.watch = (root, options = {}) => {
+  root = resolve(root)
+  const watcher = new EventEmitter()
+  const id = binding.watch(root, options, (error, events) => {
+    if (error) {
+      watcher.emit('error', new Error(error))
+      return
+    }
+    if (events === null) {
+      watcher.emit('close')
+      return
+    }
+    if (events === true) {
+      watcher.emit('ready')
+      return
+    }
+    events.forEach(event => watcher.emit('change', event))
+  })
+  watcher.close = () => binding.unwatch(id)
+  return watcher
+}
+
+// limit the async jobs and result bytes in flight, calls over the limits wait in a native queue
+exports.setLimits = limits => binding.setLimits(limits)
+
+exports.getUsage = () => binding.getUsage()
+
+const promisify = fn => (...args) => new Promise((fulfill, reject) => {
+  fn(...args, (error, data) => {
+    if (error) {
+      reject(error instanceof Error ? error : new Error(error))
+    } else {
+      fulfill(data)
+    }
+  })
+})
+
+exports.promises = {
+  writeTags: promisify(exports.writeTags),
+  writeId3Tags: promisify(exports.writeId3Tags),
+  readTags: promisify(exports.readTags),
+  readTagsBounded: promisify(exports.readTagsBounded),
+  readId3Tags: promisify(exports.readId3Tags),
+  readAudioProperties: promisify(exports.readAudioProperties)
 }
@@ -3,13 +3,54 @@
 #include <node.h>
 #include <node_buffer.h>
 
+#include <map>
+#include <memory>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cctype>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
 #define NDEBUG
 #define TAGLIB_STATIC
 #include <taglib/fileref.h>
 #include <taglib/tfile.h>
+#include <taglib/tfilestream.h>
 #include <taglib/tpropertymap.h>
 #include <taglib/mpegfile.h>
+#include <taglib/flacfile.h>
+#include <taglib/vorbisfile.h>
+#include <taglib/opusfile.h>
+#include <taglib/speexfile.h>
+#include <taglib/oggflacfile.h>
+#include <taglib/mp4file.h>
+#include <taglib/wavfile.h>
+#include <taglib/aifffile.h>
+#include <taglib/apefile.h>
+#include <taglib/wavpackfile.h>
+#include <taglib/asffile.h>
+#include <taglib/mpcfile.h>
+#include <taglib/trueaudiofile.h>
+#include <taglib/modfile.h>
+#include <taglib/s3mfile.h>
+#include <taglib/itfile.h>
+#include <taglib/xmfile.h>
 #include <taglib/id3v2tag.h>
+#include <taglib/id3v1tag.h>
+#include <taglib/apetag.h>
+#include <taglib/xiphcomment.h>
 #include <taglib/generalencapsulatedobjectframe.h>
 
 // TagLib string -> V8 string
@@ -64,6 +105,43 @@ bool ValidateCallback(v8::Local<v8::Value> callback) {
   return true;
 }
 
+// container formats which can be passed as a hint, see CreateFormatFile
+const char* const formats[] = {
+  "mpeg", "flac", "vorbis", "opus", "speex", "oggflac", "mp4",
+  "wav", "aiff", "ape", "wavpack", "asf", "mpc", "tta",
+  "mod", "s3m", "it", "xm"
+};
+
+// options shared by all file operations
+struct FileOptions {
+  double timeout = 0; // ms, 0 = none
+  TagLib::String format; // empty = sniff the header
+};
+
+bool ParseFileOptions(v8::Local<v8::Object> options, v8::Local<v8::Context> context, FileOptions &result) {
+  v8::Local<v8::Value> timeout = options->Get(context, Nan::New("timeout").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> format = options->Get(context, Nan::New("format").ToLocalChecked()).ToLocalChecked();
+
+  if (timeout->IsNumber()) {
+    result.timeout = Nan::To<double>(timeout).FromJust();
+  }
+
+  if (format->IsString()) {
+    result.format = StringToTagLibString(format.As<v8::String>());
+
+    for (const char *known : formats) {
+      if (result.format == known) {
+        return true;
+      }
+    }
+
+    Nan::ThrowTypeError("Unknown format");
+    return false;
+  }
+
+  return true;
+}
+
 // https://github.com/taglib/taglib/blob/79bb1428c0482966cdafd9b6e1127e98b4637fbf/taglib/mpeg/id3v2/id3v2frame.cpp#L92
 TagLib::ByteVector textDelimiter(TagLib::String::Type t)
 {
@@ -178,10 +256,11 @@ TagLib::PropertyMap ReadTags(TagLib::FileRef f) {
   return f.file()->properties();
 }
 
-TagLib::Map<TagLib::String, TagLib::String> ReadId3Tags(TagLib::FileRef f) {
+// mpgfile is null for the other formats, which have no GEOB frames
+TagLib::Map<TagLib::String, TagLib::String> ReadId3Tags(TagLib::MPEG::File *mpgfile) {
   TagLib::Map<TagLib::String, TagLib::String> map;
 
-  if (TagLib::MPEG::File* mpgfile = dynamic_cast<TagLib::MPEG::File*>(f.file())) {
+  if (mpgfile != nullptr) {
     TagLib::ID3v2::Tag* id3v2 = mpgfile->ID3v2Tag();
     if (id3v2 == nullptr) {
       return map;
@@ -226,8 +305,8 @@ void WriteTags(TagLib::FileRef f, TagLib::PropertyMap map) {
   }
 }
 
-void WriteId3Tags(TagLib::FileRef f, TagLib::Map<TagLib::String, TagLib::String> map) {
-  if (TagLib::MPEG::File* mpgfile = dynamic_cast<TagLib::MPEG::File*>(f.file())) {
+void WriteId3Tags(TagLib::MPEG::File *mpgfile, TagLib::Map<TagLib::String, TagLib::String> map) {
+  if (mpgfile != nullptr) {
     TagLib::ID3v2::Tag* id3v2 = mpgfile->ID3v2Tag(true);
 
     for (TagLib::Map<TagLib::String, TagLib::String>::ConstIterator i = map.begin(); i != map.end(); ++i) {
@@ -261,254 +340,1702 @@ void WriteId3Tags(TagLib::FileRef f, TagLib::Map<TagLib::String, TagLib::String>
   }
 }
 
-class ReadTagsWorker : public Nan::AsyncWorker {
-  public:
-    ReadTagsWorker(Nan::Callback *callback, TagLib::String path)
-      : Nan::AsyncWorker(callback), path(path) {}
-  ~ReadTagsWorker() { }
+// tags and audio properties of a file as seen by the last (re-)index
+struct TagSnapshot {
+  TagLib::PropertyMap tags;
+  TagLib::Map<TagLib::String, TagLib::String> audio;
+};
 
-  void Execute() {
-    TagLib::FileRef f(StringToFileName(path), false);
-    if (f.isNull()) {
-      this->SetErrorMessage("Could not parse file");
-      return;
-    }
+// per-file difference between two snapshots, emitted by the watcher
+struct WatchEvent {
+  TagLib::String path;
+  TagLib::String type; // "added", "changed" or "removed"
+  TagLib::PropertyMap added;
+  TagLib::PropertyMap changed;
+  TagLib::StringList removed;
+  TagLib::Map<TagLib::String, TagLib::String> audio;
+};
 
-    this->result = ReadTags(f);
+// diff two snapshots, returns true if anything changed
+bool DiffSnapshots(const TagSnapshot &before, const TagSnapshot &after, WatchEvent &event) {
+  for (TagLib::PropertyMap::ConstIterator i = after.tags.begin(); i != after.tags.end(); ++i) {
+    if (!before.tags.contains(i->first)) {
+      event.added.insert(i->first, i->second);
+    } else if (!(before.tags[i->first] == i->second)) {
+      event.changed.insert(i->first, i->second);
+    }
+  }
+  for (TagLib::PropertyMap::ConstIterator i = before.tags.begin(); i != before.tags.end(); ++i) {
+    if (!after.tags.contains(i->first)) {
+      event.removed.append(i->first);
+    }
+  }
+  for (TagLib::Map<TagLib::String, TagLib::String>::ConstIterator i = after.audio.begin(); i != after.audio.end(); ++i) {
+    if (!before.audio.contains(i->first) || !(before.audio[i->first] == i->second)) {
+      event.audio = after.audio;
+      break;
+    }
   }
 
-  void HandleOKCallback() {
-    v8::Local<v8::Context> context = Nan::GetCurrentContext();
+  return !event.added.isEmpty() || !event.changed.isEmpty() || !event.removed.isEmpty() || !event.audio.isEmpty();
+}
 
-    v8::Local<v8::Object> obj = PropertyMapToObject(this->result, context);
-    v8::Local<v8::Value> argv[2] = {
-      Nan::Null(),
-      obj
-    };
+// watch event -> v8 object, empty sections are left out
+v8::Local<v8::Object> WatchEventToObject(const WatchEvent &event, v8::Local<v8::Context> context) {
+  v8::Local<v8::Object> obj = Nan::New<v8::Object>();
 
-    callback->Call(2, argv, async_resource);
+  obj->Set(context, Nan::New("path").ToLocalChecked(), TagLibStringToString(event.path));
+  obj->Set(context, Nan::New("type").ToLocalChecked(), TagLibStringToString(event.type));
+
+  if (!event.added.isEmpty()) {
+    obj->Set(context, Nan::New("added").ToLocalChecked(), PropertyMapToObject(event.added, context));
+  }
+  if (!event.changed.isEmpty()) {
+    obj->Set(context, Nan::New("changed").ToLocalChecked(), PropertyMapToObject(event.changed, context));
   }
+  if (!event.removed.isEmpty()) {
+    v8::Local<v8::Array> array = Nan::New<v8::Array>(event.removed.size());
 
-  void HandleErrorCallback() {
-    v8::Local<v8::Value> argv[2] = {
-      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
-      Nan::Null()
-    };
+    int index = 0;
+    for (TagLib::StringList::ConstIterator j = event.removed.begin(); j != event.removed.end(); ++j) {
+      array->Set(context, index++, TagLibStringToString(*j));
+    }
 
-    callback->Call(2, argv, async_resource);
+    obj->Set(context, Nan::New("removed").ToLocalChecked(), array);
+  }
+  if (!event.audio.isEmpty()) {
+    obj->Set(context, Nan::New("audio").ToLocalChecked(), MapToObject(event.audio, context));
   }
 
-  private:
-    TagLib::String path;
-    TagLib::PropertyMap result;
-};
+  return obj;
+}
+
+// cancellation state of an async job, shared between the main and the worker thread
+class JobControl {
+  typedef std::chrono::steady_clock Clock;
 
-class ReadAudioPropertiesWorker : public Nan::AsyncWorker {
   public:
-    ReadAudioPropertiesWorker(Nan::Callback *callback, TagLib::String path)
-      : Nan::AsyncWorker(callback), path(path) {}
-  ~ReadAudioPropertiesWorker() { }
+    JobControl(double timeout)
+      : aborted(false), hasDeadline(timeout > 0),
+        deadline(Clock::now() + std::chrono::milliseconds((long long) timeout)) {}
 
-  void Execute() {
-    TagLib::FileRef f(StringToFileName(path), true, TagLib::AudioProperties::Fast);
-    if (f.isNull()) {
-      this->SetErrorMessage("Could not parse file");
-      return;
+    void Abort() {
+      aborted = true;
     }
 
-    this->result = ReadAudioProperties(f);
-  }
-
-  void HandleOKCallback() {
-    v8::Local<v8::Context> context = Nan::GetCurrentContext();
-
-    v8::Local<v8::Object> obj = MapToObject(this->result, context);
-    v8::Local<v8::Value> argv[2] = {
-      Nan::Null(),
-      obj
-    };
-
-    callback->Call(2, argv, async_resource);
-  }
+    bool Expired() const {
+      return aborted || (hasDeadline && Clock::now() >= deadline);
+    }
 
-  void HandleErrorCallback() {
-    v8::Local<v8::Value> argv[2] = {
-      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
-      Nan::Null()
-    };
+    const char* Reason() const {
+      return aborted ? "Operation aborted" : "Operation timed out";
+    }
 
-    callback->Call(2, argv, async_resource);
-  }
+    // ms until the deadline, -1 if there is none
+    long long Remaining() const {
+      if (!hasDeadline) {
+        return -1;
+      }
+      long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+      return remaining > 0 ? remaining + 1 : 0;
+    }
 
   private:
-    TagLib::String path;
-    TagLib::Map<TagLib::String, TagLib::String> result;
+    std::atomic<bool> aborted;
+    bool hasDeadline;
+    Clock::time_point deadline;
 };
 
-class ReadId3TagsWorker : public Nan::AsyncWorker {
+// queued and running async jobs by id, only touched from the main thread
+std::map<uint32_t, JobControl*> jobs;
+uint32_t nextJobId = 1;
+
+// file stream which stops reading at the next block once its job has expired
+// and counts the bytes it reads and the seeks it does
+class CancellableStream : public TagLib::FileStream {
   public:
-    ReadId3TagsWorker(Nan::Callback *callback, TagLib::String path)
-      : Nan::AsyncWorker(callback), path(path) {}
-  ~ReadId3TagsWorker() { }
+    CancellableStream(TagLib::FileName path, JobControl *control, bool openReadOnly)
+      : TagLib::FileStream(path, openReadOnly), control(control), committed(false), bytesRead(0), seeks(0), internal(0) {}
 
-  void Execute() {
-    TagLib::FileRef f(StringToFileName(path), false);
-    if (f.isNull()) {
-      this->SetErrorMessage("Could not parse file");
-      return;
+    TagLib::ByteVector readBlock(unsigned long length) {
+      if (!committed && control != nullptr && control->Expired()) {
+        return TagLib::ByteVector();
+      }
+      internal++;
+      TagLib::ByteVector data = TagLib::FileStream::readBlock(length);
+      internal--;
+      bytesRead += data.size();
+      return data;
     }
 
-    this->result = ReadId3Tags(f);
-  }
-
-  void HandleOKCallback() {
-    v8::Local<v8::Context> context = Nan::GetCurrentContext();
+    // FileStream::length() seeks to the end and back, also from within readBlock(), which is not real I/O
+    long length() {
+      internal++;
+      long size = TagLib::FileStream::length();
+      internal--;
+      return size;
+    }
 
-    v8::Local<v8::Object> obj = MapToObject(this->result, context);
-    v8::Local<v8::Value> argv[2] = {
-      Nan::Null(),
-      obj
-    };
+    void seek(long offset, Position p = Beginning) {
+      if (internal == 0) {
+        seeks++;
+      }
+      TagLib::FileStream::seek(offset, p);
+    }
 
-    callback->Call(2, argv, async_resource);
-  }
+    unsigned long long BytesRead() const {
+      return bytesRead;
+    }
 
-  void HandleErrorCallback() {
-    v8::Local<v8::Value> argv[2] = {
-      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
-      Nan::Null()
-    };
+    unsigned long long Seeks() const {
+      return seeks;
+    }
 
-    callback->Call(2, argv, async_resource);
-  }
+    // from here on reads are never cut short, so that a save cannot leave a broken file
+    void Commit() {
+      committed = true;
+    }
 
   private:
-    TagLib::String path;
-    TagLib::Map<TagLib::String, TagLib::String> result;
+    JobControl *control;
+    bool committed;
+    unsigned long long bytesRead;
+    unsigned long long seeks;
+    int internal; // depth of inherited calls whose seeks are not counted
 };
 
-class WriteTagsWorker : public Nan::AsyncWorker {
-  public:
-    WriteTagsWorker(Nan::Callback *callback, TagLib::String path, TagLib::PropertyMap map)
-      : Nan::AsyncWorker(callback), path(path), map(map) {}
-  ~WriteTagsWorker() { }
+// ProTracker style MOD, identified by the channel tag after the 31 sample headers and the order list
+bool IsModSignature(const TagLib::ByteVector &header) {
+  const unsigned int offset = 1080;
+  if (header.size() < offset + 4) {
+    return false;
+  }
 
-  void Execute() {
-    TagLib::FileRef f(StringToFileName(path), false);
-    if (f.isNull()) {
-      this->SetErrorMessage("Could not parse file");
-      return;
+  const char* const tags[] = { "M.K.", "M!K!", "M&K!", "N.T.", "FLT4", "FLT8", "CD81", "OKTA", "OCTA" };
+  for (unsigned int i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+    if (header.containsAt(tags[i], offset)) {
+      return true;
     }
-
-    TagLib::PropertyMap existingProperties = ReadTags(f);
-    TagLib::PropertyMap newProperties = MergePropertyMaps(existingProperties, this->map);
-    WriteTags(f, newProperties);
   }
 
-  void HandleOKCallback() {
-    v8::Local<v8::Value> argv[2] = {
-      Nan::Null(),
-      Nan::True()
-    };
-
-    callback->Call(2, argv, async_resource);
+  // xCHN, xxCH and TDZx carry the channel count
+  char c0 = header[offset], c1 = header[offset + 1], c2 = header[offset + 2], c3 = header[offset + 3];
+  if (isdigit((unsigned char) c0) && c1 == 'C' && c2 == 'H' && c3 == 'N') {
+    return true;
   }
-
-  void HandleErrorCallback() {
-    v8::Local<v8::Value> argv[2] = {
-      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
-      Nan::Null()
-    };
-
-    callback->Call(2, argv, async_resource);
+  if (isdigit((unsigned char) c0) && isdigit((unsigned char) c1) && c2 == 'C' && c3 == 'H') {
+    return true;
   }
+  return header.containsAt("TDZ", offset) && isdigit((unsigned char) c3);
+}
 
-  private:
-    TagLib::String path;
-    TagLib::PropertyMap map;
+// the start of a file as read by the sniffer, handed on so that bounded readers do not read it again
+struct SniffResult {
+  TagLib::String format;
+  TagLib::ByteVector id3v2Header; // empty without a leading ID3v2 tag
+  long id3v2Size = 0; // including the header and footer
+  TagLib::ByteVector start; // the window after the ID3v2 tag
 };
 
-class WriteId3TagsWorker : public Nan::AsyncWorker {
-  public:
-    WriteId3TagsWorker(Nan::Callback *callback, TagLib::String path, TagLib::Map<TagLib::String, TagLib::String> map)
-      : Nan::AsyncWorker(callback), path(path), map(map) {}
-  ~WriteId3TagsWorker() { }
-
-  void Execute() {
-    TagLib::FileRef f(StringToFileName(path), false);
-    if (f.isNull()) {
-      this->SetErrorMessage("Could not parse file");
-      return;
+// format of the bytes at the start of a file, behind a leading ID3v2 tag if there is one
+TagLib::String SniffHeader(const TagLib::ByteVector &header, bool id3v2) {
+  if (header.startsWith("fLaC")) {
+    return "flac";
+  }
+  if (header.startsWith("MAC ")) {
+    return "ape";
+  }
+  if (header.startsWith("TTA1")) {
+    return "tta";
+  }
+  if (header.startsWith("wvpk")) {
+    return "wavpack";
+  }
+  if (header.startsWith("MPCK") || header.startsWith("MP+")) {
+    return "mpc";
+  }
+  if (header.startsWith("OggS") && header.size() > 27) {
+    // identification header in the first packet of the first page
+    unsigned int packet = 27 + (unsigned char) header[26];
+    if (header.containsAt("\x01vorbis", packet)) {
+      return "vorbis";
+    }
+    if (header.containsAt("OpusHead", packet)) {
+      return "opus";
     }
+    if (header.containsAt("Speex   ", packet)) {
+      return "speex";
+    }
+    if (header.containsAt("\x7f" "FLAC", packet) || header.containsAt("fLaC", packet)) {
+      return "oggflac";
+    }
+    return TagLib::String();
+  }
+  if (header.startsWith("RIFF") && header.containsAt("WAVE", 8)) {
+    return "wav";
+  }
+  if (header.startsWith("FORM") && (header.containsAt("AIFF", 8) || header.containsAt("AIFC", 8))) {
+    return "aiff";
+  }
+  if (header.containsAt("ftyp", 4)) {
+    return "mp4";
+  }
+  if (header.startsWith(TagLib::ByteVector("\x30\x26\xb2\x75\x8e\x66\xcf\x11", 8))) {
+    return "asf";
+  }
+  if (header.startsWith("IMPM")) {
+    return "it";
+  }
+  if (header.containsAt("SCRM", 44)) {
+    return "s3m";
+  }
+  if (header.startsWith("Extended Module: ")) {
+    return "xm";
+  }
+  if (IsModSignature(header)) {
+    return "mod";
+  }
 
-    WriteId3Tags(f, this->map);
+  // MPEG audio frame sync with a valid version, layer and bitrate
+  for (unsigned int i = 0; i + 2 < header.size(); i++) {
+    unsigned char b1 = header[i];
+    unsigned char b2 = header[i + 1];
+    unsigned char b3 = header[i + 2];
+    if (b1 == 0xff && (b2 & 0xe0) == 0xe0 && (b2 & 0x18) != 0x08 && (b2 & 0x06) != 0x00 && (b3 & 0xf0) != 0xf0) {
+      return "mpeg";
+    }
   }
 
-  void HandleOKCallback() {
-    v8::Local<v8::Value> argv[2] = {
-      Nan::Null(),
-      Nan::True()
-    };
+  return id3v2 ? "mpeg" : TagLib::String();
+}
 
-    callback->Call(2, argv, async_resource);
-  }
+// read the first window of a file and the one after a leading ID3v2 tag, and guess the format from them
+// with detect=false only the 10 bytes of a leading ID3v2 header are read, format and start stay empty
+SniffResult SniffStart(TagLib::IOStream *stream, unsigned long window, bool detect = true) {
+  SniffResult sniffed;
+  stream->seek(0);
+  TagLib::ByteVector header = stream->readBlock(detect ? window : 10);
+
+  // skip a leading ID3v2 tag, some tools prepend one to FLAC, APE and TTA
+  if (header.size() >= 10 && header.startsWith("ID3")) {
+    sniffed.id3v2Header = header.mid(0, 10);
+    sniffed.id3v2Size = 10
+      + ((header[6] & 0x7f) << 21)
+      + ((header[7] & 0x7f) << 14)
+      + ((header[8] & 0x7f) << 7)
+      + (header[9] & 0x7f);
+    if (header[5] & 0x10) {
+      sniffed.id3v2Size += 10; // footer
+    }
 
-  void HandleErrorCallback() {
-    v8::Local<v8::Value> argv[2] = {
-      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
-      Nan::Null()
-    };
+    if (detect) {
+      stream->seek(sniffed.id3v2Size);
+      header = stream->readBlock(window);
+    }
+  }
 
-    callback->Call(2, argv, async_resource);
+  if (detect) {
+    sniffed.start = header;
+    sniffed.format = SniffHeader(header, !sniffed.id3v2Header.isEmpty());
   }
+  return sniffed;
+}
 
-  private:
-    TagLib::String path;
-    TagLib::Map<TagLib::String, TagLib::String> map;
-};
+// guess the container format from the first few KB, empty if unknown
+TagLib::String SniffFormat(TagLib::IOStream *stream, unsigned long window = 4096) {
+  TagLib::String format = SniffStart(stream, window).format;
+  stream->seek(0);
+  return format;
+}
 
-NAN_METHOD(writeTags) {
-  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+// construct the TagLib file type for a format directly, nullptr if unknown
+TagLib::File* CreateFormatFile(TagLib::IOStream *stream, const TagLib::String &format, bool readAudioProperties) {
+  const TagLib::AudioProperties::ReadStyle style = TagLib::AudioProperties::Fast;
 
-  if (info.Length() != 3) {
-    Nan::ThrowTypeError("Expected 3 arguments");
-    return;
+  if (format == "mpeg") {
+    return new TagLib::MPEG::File(stream, TagLib::ID3v2::FrameFactory::instance(), readAudioProperties, style);
+  }
+  if (format == "flac") {
+    return new TagLib::FLAC::File(stream, TagLib::ID3v2::FrameFactory::instance(), readAudioProperties, style);
+  }
+  if (format == "vorbis") {
+    return new TagLib::Ogg::Vorbis::File(stream, readAudioProperties, style);
+  }
+  if (format == "opus") {
+    return new TagLib::Ogg::Opus::File(stream, readAudioProperties, style);
+  }
+  if (format == "speex") {
+    return new TagLib::Ogg::Speex::File(stream, readAudioProperties, style);
+  }
+  if (format == "oggflac") {
+    return new TagLib::Ogg::FLAC::File(stream, readAudioProperties, style);
+  }
+  if (format == "mp4") {
+    return new TagLib::MP4::File(stream, readAudioProperties, style);
+  }
+  if (format == "wav") {
+    return new TagLib::RIFF::WAV::File(stream, readAudioProperties, style);
+  }
+  if (format == "aiff") {
+    return new TagLib::RIFF::AIFF::File(stream, readAudioProperties, style);
+  }
+  if (format == "ape") {
+    return new TagLib::APE::File(stream, readAudioProperties, style);
+  }
+  if (format == "wavpack") {
+    return new TagLib::WavPack::File(stream, readAudioProperties, style);
+  }
+  if (format == "asf") {
+    return new TagLib::ASF::File(stream, readAudioProperties, style);
+  }
+  if (format == "mpc") {
+    return new TagLib::MPC::File(stream, readAudioProperties, style);
+  }
+  if (format == "tta") {
+    return new TagLib::TrueAudio::File(stream, readAudioProperties, style);
+  }
+  if (format == "mod") {
+    return new TagLib::Mod::File(stream, readAudioProperties, style);
+  }
+  if (format == "s3m") {
+    return new TagLib::S3M::File(stream, readAudioProperties, style);
+  }
+  if (format == "it") {
+    return new TagLib::IT::File(stream, readAudioProperties, style);
+  }
+  if (format == "xm") {
+    return new TagLib::XM::File(stream, readAudioProperties, style);
   }
 
-  if (!ValidatePath(info[0])
-      || !ValidateProperties(info[1])
-      || !ValidateCallback(info[2])) {
-    return;
+  return nullptr;
+}
+
+// open a file as the hinted format, or as the sniffed one without a hint
+// a file which is not recognized results in a null FileRef without being parsed
+TagLib::FileRef OpenFile(TagLib::IOStream *stream, TagLib::String format, bool readAudioProperties) {
+  if (!stream->isOpen()) {
+    return TagLib::FileRef();
   }
 
-  v8::Local<v8::String> opt_path = info[0].As<v8::String>();
-  v8::Local<v8::Object> opt_props = info[1].As<v8::Object>();
-  v8::Local<v8::Function> opt_callback = info[2].As<v8::Function>();
+  if (format.isEmpty()) {
+    format = SniffFormat(stream);
+  }
 
-  TagLib::String path = StringToTagLibString(opt_path);
-  TagLib::PropertyMap map = ObjectToPropertyMap(opt_props, context);
+  TagLib::File *file = CreateFormatFile(stream, format, readAudioProperties);
+  if (file == nullptr) {
+    return TagLib::FileRef();
+  }
 
-  Nan::Callback *callback = new Nan::Callback(opt_callback);
-  AsyncQueueWorker(new WriteTagsWorker(callback, path, map));
+  return TagLib::FileRef(file);
 }
 
-NAN_METHOD(writeTagsSync) {
-  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+// open a file for the GEOB functions, only MPEG files are parsed and the others are left null
+// false if the file is not recognized or not a valid MPEG file
+bool OpenMpegFile(TagLib::IOStream *stream, TagLib::String format, std::unique_ptr<TagLib::MPEG::File> &file) {
+  if (!stream->isOpen()) {
+    return false;
+  }
 
-  if (info.Length() != 2) {
-    Nan::ThrowTypeError("Expected 2 arguments");
-    return;
+  if (format.isEmpty()) {
+    format = SniffFormat(stream);
   }
 
-  if (!ValidatePath(info[0]) || !ValidateProperties(info[1])) {
-    return;
+  if (format == "mpeg") {
+    file.reset(new TagLib::MPEG::File(stream, TagLib::ID3v2::FrameFactory::instance(), false, TagLib::AudioProperties::Fast));
+    return file->isValid();
   }
 
-  v8::Local<v8::String> opt_path = info[0].As<v8::String>();
-  v8::Local<v8::Object> opt_props = info[1].As<v8::Object>();
+  return !format.isEmpty();
+}
+
+// smallest sniffing window which still sees all signatures, keeps bounded reads out of the audio data
+const unsigned long boundedSniffWindow = 64;
+
+// ID3v2 tag parsed from a header which has already been read, only the body is read from the stream
+class WindowID3v2Tag : public TagLib::ID3v2::Tag {
+  public:
+    WindowID3v2Tag(TagLib::IOStream *stream, const SniffResult &sniffed) {
+      this->header()->setData(sniffed.id3v2Header);
+      unsigned int size = this->header()->tagSize();
+      if (size == 0) {
+        return;
+      }
+
+      stream->seek(10);
+      TagLib::ByteVector body = stream->readBlock(size);
+      if (body.size() == size) {
+        this->parse(body);
+      }
+    }
+};
+
+// ID3v1 tag parsed from the footer window which has already been read
+class WindowID3v1Tag : public TagLib::ID3v1::Tag {
+  public:
+    WindowID3v1Tag(const TagLib::ByteVector &data) {
+      this->parse(data);
+    }
+};
+
+// APE tag parsed from a footer which has already been read, only the items are read from the stream
+class WindowAPETag : public TagLib::APE::Tag {
+  public:
+    WindowAPETag(TagLib::IOStream *stream, const TagLib::ByteVector &footer, long footerLocation, long length) {
+      this->footer()->setData(footer);
+      long size = this->footer()->tagSize();
+      if (size <= 32 || size > length) {
+        return;
+      }
+
+      stream->seek(footerLocation + 32 - size);
+      TagLib::ByteVector items = stream->readBlock(size - 32);
+      if ((long) items.size() == size - 32) {
+        this->parse(items);
+      }
+    }
+};
+
+// ID3v2 at the start, APE and ID3v1 at the end, the first non-empty tag in priority order wins
+bool ReadWindowTags(TagLib::IOStream *stream, const SniffResult &sniffed, bool apeFirst, TagLib::PropertyMap &result) {
+  TagLib::PropertyMap id3v2;
+  TagLib::PropertyMap ape;
+  TagLib::PropertyMap id3v1;
+
+  // the body behind the sniffed ID3v2 header
+  if (!sniffed.id3v2Header.isEmpty()) {
+    id3v2 = WindowID3v2Tag(stream, sniffed).properties();
+  }
+
+  // the last 128 bytes for ID3v1 and the APE footer in front of them
+  long length = stream->length();
+  long window = length >= 160 ? 160 : length;
+  stream->seek(length - window);
+  TagLib::ByteVector footer = stream->readBlock(window);
+  if ((long) footer.size() != window) {
+    return false;
+  }
+
+  // both tags are parsed from the window, only the APE items in front of it are read
+  long apeFooter = length - 32;
+  if (window >= 128 && footer.containsAt("TAG", window - 128)) {
+    id3v1 = WindowID3v1Tag(footer.mid(window - 128)).properties();
+    apeFooter -= 128;
+  }
+  if (apeFooter >= length - window && footer.containsAt("APETAGEX", apeFooter - (length - window))) {
+    ape = WindowAPETag(stream, footer.mid(apeFooter - (length - window), 32), apeFooter, length).properties();
+  }
+
+  const TagLib::PropertyMap *order[3] = { &id3v2, &ape, &id3v1 };
+  if (apeFirst) {
+    order[0] = &ape;
+    order[1] = &id3v1;
+    order[2] = &id3v2;
+  }
+  for (int i = 0; i < 3; i++) {
+    if (!order[i]->isEmpty()) {
+      result = *order[i];
+      break;
+    }
+  }
+
+  return true;
+}
+
+// walk the FLAC metadata blocks, skipping everything but the Vorbis comment
+bool ReadFlacBlocks(TagLib::IOStream *stream, const SniffResult &sniffed, TagLib::PropertyMap &result) {
+  TagLib::PropertyMap id3v2;
+
+  if (!sniffed.id3v2Header.isEmpty()) {
+    id3v2 = WindowID3v2Tag(stream, sniffed).properties();
+  }
+
+  // the sniffer has already seen the stream marker, otherwise check it here
+  if (sniffed.start.startsWith("fLaC")) {
+    stream->seek(sniffed.id3v2Size + 4);
+  } else {
+    stream->seek(sniffed.id3v2Size);
+    if (!stream->readBlock(4).startsWith("fLaC")) {
+      return false;
+    }
+  }
+
+  bool last = false;
+  while (!last) {
+    TagLib::ByteVector block = stream->readBlock(4);
+    if (block.size() != 4) {
+      return false;
+    }
+
+    unsigned char type = block[0] & 0x7f;
+    unsigned int size = block.toUInt(1, 3, true);
+    last = block[0] & 0x80;
+
+    if (type == 127) {
+      return false; // invalid, the audio frames may start here
+    }
+
+    if (type == 4) {
+      TagLib::ByteVector data = stream->readBlock(size);
+      if (data.size() != size) {
+        return false;
+      }
+      result = TagLib::Ogg::XiphComment(data).properties();
+    } else if (!last) {
+      stream->seek(size, TagLib::IOStream::Current);
+    }
+  }
+
+  if (result.isEmpty()) {
+    result = id3v2;
+  }
+
+  return true;
+}
+
+// header pages read before giving up, enough for a comment packet with large embedded pictures
+const unsigned int maxOggHeaderPages = 512;
+
+// read the Ogg pages of the first two packets and parse the comment header
+// stops at the first audio page, recognized by its granule position
+bool ReadOggComment(TagLib::IOStream *stream, const TagLib::String &format, TagLib::PropertyMap &result) {
+  TagLib::ByteVector packet;
+  int index = 0;
+
+  stream->seek(0);
+  for (unsigned int page = 0; page < maxOggHeaderPages; page++) {
+    TagLib::ByteVector header = stream->readBlock(27);
+    if (header.size() != 27 || !header.startsWith("OggS")) {
+      return false;
+    }
+
+    unsigned int segments = (unsigned char) header[26];
+    TagLib::ByteVector lacing = stream->readBlock(segments);
+    if (lacing.size() != segments) {
+      return false;
+    }
+
+    // header pages have a granule position of 0, or -1 if no packet ends on them
+    TagLib::ByteVector granule = header.mid(6, 8);
+    bool continued = segments > 0 && (unsigned char) lacing[segments - 1] == 255;
+    if (granule != TagLib::ByteVector(8, '\0') && !(continued && granule == TagLib::ByteVector(8, '\xff'))) {
+      return false;
+    }
+
+    unsigned int size = 0;
+    for (unsigned int i = 0; i < segments; i++) {
+      size += (unsigned char) lacing[i];
+    }
+
+    TagLib::ByteVector body = stream->readBlock(size);
+    if (body.size() != size) {
+      return false;
+    }
+
+    unsigned int position = 0;
+    for (unsigned int i = 0; i < segments; i++) {
+      unsigned int length = (unsigned char) lacing[i];
+      packet.append(body.mid(position, length));
+      position += length;
+
+      // a lacing value below 255 ends the packet
+      if (length == 255) {
+        continue;
+      }
+
+      if (index == 1) {
+        if (format == "vorbis" && packet.startsWith("\x03vorbis")) {
+          result = TagLib::Ogg::XiphComment(packet.mid(7)).properties();
+        } else if (format == "opus" && packet.startsWith("OpusTags")) {
+          result = TagLib::Ogg::XiphComment(packet.mid(8)).properties();
+        } else if (format == "speex") {
+          result = TagLib::Ogg::XiphComment(packet).properties();
+        } else if (format == "oggflac" && packet.size() > 4 && (packet[0] & 0x7f) == 4) {
+          result = TagLib::Ogg::XiphComment(packet.mid(4)).properties();
+        } else {
+          return false;
+        }
+        return true;
+      }
+
+      index++;
+      packet = TagLib::ByteVector();
+    }
+  }
+
+  return false;
+}
+
+// read the tags from header and footer windows only, never touching the audio data
+// returns false if the file could not be read or the format does not allow it
+bool ReadBoundedTags(TagLib::IOStream *stream, TagLib::String format, TagLib::PropertyMap &result) {
+  if (!stream->isOpen()) {
+    return false;
+  }
+
+  // with a hint only the ID3v2 header is read, the readers parse the tag from it
+  SniffResult sniffed = SniffStart(stream, boundedSniffWindow, format.isEmpty());
+  if (format.isEmpty()) {
+    format = sniffed.format;
+  }
+
+  if (format == "mpeg" || format == "tta") {
+    return ReadWindowTags(stream, sniffed, false, result);
+  }
+  if (format == "ape" || format == "wavpack" || format == "mpc") {
+    return ReadWindowTags(stream, sniffed, true, result);
+  }
+  if (format == "flac") {
+    return ReadFlacBlocks(stream, sniffed, result);
+  }
+  if (format == "vorbis" || format == "opus" || format == "speex" || format == "oggflac") {
+    return ReadOggComment(stream, format, result);
+  }
+
+  return false;
+}
+
+// bounded read result -> v8 object with the tags and the I/O it took
+v8::Local<v8::Object> BoundedResultToObject(TagLib::PropertyMap tags, unsigned long long bytesRead, unsigned long long seeks, v8::Local<v8::Context> context) {
+  v8::Local<v8::Object> io = Nan::New<v8::Object>();
+  io->Set(context, Nan::New("bytesRead").ToLocalChecked(), Nan::New<v8::Number>((double) bytesRead));
+  io->Set(context, Nan::New("seeks").ToLocalChecked(), Nan::New<v8::Number>((double) seeks));
+
+  v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+  obj->Set(context, Nan::New("tags").ToLocalChecked(), PropertyMapToObject(tags, context));
+  obj->Set(context, Nan::New("io").ToLocalChecked(), io);
+
+  return obj;
+}
+
+// approximate memory held by tag data, used for admission control
+size_t ByteSize(const TagLib::String &s) {
+  return sizeof(TagLib::String) + s.size() * sizeof(wchar_t);
+}
+
+size_t ByteSize(const TagLib::PropertyMap &map) {
+  size_t size = 0;
+  for (TagLib::PropertyMap::ConstIterator i = map.begin(); i != map.end(); ++i) {
+    size += ByteSize(i->first);
+    for (TagLib::StringList::ConstIterator j = i->second.begin(); j != i->second.end(); ++j) {
+      size += ByteSize(*j);
+    }
+  }
+  return size;
+}
+
+size_t ByteSize(const TagLib::Map<TagLib::String, TagLib::String> &map) {
+  size_t size = 0;
+  for (TagLib::Map<TagLib::String, TagLib::String>::ConstIterator i = map.begin(); i != map.end(); ++i) {
+    size += ByteSize(i->first) + ByteSize(i->second);
+  }
+  return size;
+}
+
+class JobWorker;
+
+// bytes reserved for the result of a read job before its size is known, a typical tag set
+const size_t resultEstimate = 4096;
+
+// limits the async jobs and result bytes in flight, jobs over the limits wait here instead of in the threadpool
+struct Admission {
+  size_t maxJobs = 0; // 0 = unlimited
+  size_t maxBytes = 0; // 0 = unlimited
+  size_t jobs = 0;
+  std::atomic<size_t> bytes{0}; // also updated from worker threads
+  std::deque<JobWorker*> queue;
+  std::vector<JobWorker*> failed; // aborted or expired while queued, called back by the timer
+  uv_timer_t timer;
+  bool timerReady = false;
+};
+Admission admission;
+
+void PumpJobs();
+
+// async job which can be aborted or time out
+class JobWorker : public Nan::AsyncWorker {
+  public:
+    JobWorker(Nan::Callback *callback, TagLib::String path, FileOptions options)
+      : Nan::AsyncWorker(callback), id(nextJobId++), path(path), format(options.format), control(options.timeout),
+        dispatched(false), held(0), reserved(0) {
+      jobs[id] = &control;
+    }
+  ~JobWorker() {
+    jobs.erase(id);
+    if (dispatched) {
+      admission.jobs--;
+    }
+    admission.bytes -= held;
+    PumpJobs();
+  }
+
+  uint32_t Id() const {
+    return id;
+  }
+
+  bool Expired() const {
+    return control.Expired();
+  }
+
+  // hand the job to the threadpool
+  void Dispatch() {
+    dispatched = true;
+    admission.jobs++;
+    this->Prepare();
+    reserved = this->ResultEstimate();
+    this->Hold(this->InputBytes() + reserved);
+    AsyncQueueWorker(this);
+  }
+
+  // call back a job which never left the queue
+  void Fail() {
+    this->SetErrorMessage(control.Reason());
+    this->WorkComplete();
+    this->Destroy();
+  }
+
+  long long Remaining() const {
+    return control.Remaining();
+  }
+
+  protected:
+    // main thread, convert the arguments once the job has been admitted
+    virtual void Prepare() {}
+
+    // true if the job has been aborted or timed out
+    bool Cancelled() {
+      if (control.Expired()) {
+        this->SetErrorMessage(control.Reason());
+        return true;
+      }
+      return false;
+    }
+
+    // memory held by the job's arguments while it runs
+    virtual size_t InputBytes() const {
+      return 0;
+    }
+
+    // memory reserved for the result when the job is admitted, until HoldResult knows the real size
+    virtual size_t ResultEstimate() const {
+      return 0;
+    }
+
+    // account memory which is held until the callback has run
+    void Hold(size_t size) {
+      held += size;
+      admission.bytes += size;
+    }
+
+    // replace the reserved estimate with the real size of the result
+    void HoldResult(size_t size) {
+      this->Hold(size);
+      held -= reserved;
+      admission.bytes -= reserved;
+      reserved = 0;
+    }
+
+    uint32_t id;
+    TagLib::String path;
+    TagLib::String format;
+    JobControl control;
+
+  private:
+    bool dispatched;
+    size_t held;
+    size_t reserved;
+};
+
+void OnAdmissionTimer(uv_timer_t *timer);
+
+// wake up once a queued job has to be failed or its deadline passes
+void ScheduleAdmissionTimer() {
+  if (!admission.timerReady) {
+    uv_timer_init(Nan::GetCurrentEventLoop(), &admission.timer);
+    uv_unref((uv_handle_t*) &admission.timer);
+    admission.timerReady = true;
+  }
+
+  long long wait = -1;
+  if (!admission.failed.empty()) {
+    wait = 0;
+  } else {
+    for (auto it = admission.queue.begin(); it != admission.queue.end(); it++) {
+      long long remaining = (*it)->Remaining();
+      if (remaining >= 0 && (wait < 0 || remaining < wait)) {
+        wait = remaining;
+      }
+    }
+  }
+
+  if (wait < 0) {
+    uv_timer_stop(&admission.timer);
+  } else {
+    uv_timer_start(&admission.timer, OnAdmissionTimer, wait, 0);
+  }
+}
+
+// drop aborted and expired jobs from the queue, then dispatch queued jobs while there is capacity
+void PumpJobs() {
+  for (auto it = admission.queue.begin(); it != admission.queue.end(); ) {
+    if ((*it)->Expired()) {
+      admission.failed.push_back(*it);
+      it = admission.queue.erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  while (!admission.queue.empty()) {
+    bool capacity = (admission.maxJobs == 0 || admission.jobs < admission.maxJobs)
+      && (admission.maxBytes == 0 || admission.bytes < admission.maxBytes);
+    if (!capacity) {
+      break;
+    }
+
+    JobWorker *worker = admission.queue.front();
+    admission.queue.pop_front();
+    worker->Dispatch();
+  }
+
+  ScheduleAdmissionTimer();
+}
+
+void OnAdmissionTimer(uv_timer_t *timer) {
+  std::vector<JobWorker*> failed;
+  failed.swap(admission.failed);
+  for (auto it = failed.begin(); it != failed.end(); it++) {
+    (*it)->Fail();
+  }
+
+  PumpJobs();
+}
+
+void SubmitJob(JobWorker *worker) {
+  admission.queue.push_back(worker);
+  PumpJobs();
+}
+
+class ReadTagsWorker : public JobWorker {
+  public:
+    ReadTagsWorker(Nan::Callback *callback, TagLib::String path, FileOptions options)
+      : JobWorker(callback, path, options) {}
+  ~ReadTagsWorker() { }
+
+  size_t ResultEstimate() const {
+    return resultEstimate;
+  }
+
+  void Execute() {
+    if (this->Cancelled()) {
+      return;
+    }
+
+    CancellableStream stream(StringToFileName(path), &control, true);
+    TagLib::FileRef f = OpenFile(&stream, format, false);
+    if (this->Cancelled()) {
+      return;
+    }
+    if (f.isNull()) {
+      this->SetErrorMessage("Could not parse file");
+      return;
+    }
+
+    this->result = ReadTags(f);
+    this->HoldResult(ByteSize(this->result));
+  }
+
+  void HandleOKCallback() {
+    v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+    v8::Local<v8::Object> obj = PropertyMapToObject(this->result, context);
+    v8::Local<v8::Value> argv[2] = {
+      Nan::Null(),
+      obj
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  void HandleErrorCallback() {
+    v8::Local<v8::Value> argv[2] = {
+      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
+      Nan::Null()
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  private:
+    TagLib::PropertyMap result;
+};
+
+class ReadTagsBoundedWorker : public JobWorker {
+  public:
+    ReadTagsBoundedWorker(Nan::Callback *callback, TagLib::String path, FileOptions options)
+      : JobWorker(callback, path, options), bytesRead(0), seeks(0) {}
+  ~ReadTagsBoundedWorker() { }
+
+  size_t ResultEstimate() const {
+    return resultEstimate;
+  }
+
+  void Execute() {
+    if (this->Cancelled()) {
+      return;
+    }
+
+    CancellableStream stream(StringToFileName(path), &control, true);
+    bool parsed = ReadBoundedTags(&stream, format, this->result);
+    this->bytesRead = stream.BytesRead();
+    this->seeks = stream.Seeks();
+    if (this->Cancelled()) {
+      return;
+    }
+    if (!parsed) {
+      this->SetErrorMessage("Could not parse file");
+      return;
+    }
+
+    this->HoldResult(ByteSize(this->result));
+  }
+
+  void HandleOKCallback() {
+    v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+    v8::Local<v8::Object> obj = BoundedResultToObject(this->result, this->bytesRead, this->seeks, context);
+    v8::Local<v8::Value> argv[2] = {
+      Nan::Null(),
+      obj
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  void HandleErrorCallback() {
+    v8::Local<v8::Value> argv[2] = {
+      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
+      Nan::Null()
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  private:
+    TagLib::PropertyMap result;
+    unsigned long long bytesRead;
+    unsigned long long seeks;
+};
+
+class ReadAudioPropertiesWorker : public JobWorker {
+  public:
+    ReadAudioPropertiesWorker(Nan::Callback *callback, TagLib::String path, FileOptions options)
+      : JobWorker(callback, path, options) {}
+  ~ReadAudioPropertiesWorker() { }
+
+  size_t ResultEstimate() const {
+    return resultEstimate;
+  }
+
+  void Execute() {
+    if (this->Cancelled()) {
+      return;
+    }
+
+    CancellableStream stream(StringToFileName(path), &control, true);
+    TagLib::FileRef f = OpenFile(&stream, format, true);
+    if (this->Cancelled()) {
+      return;
+    }
+    if (f.isNull()) {
+      this->SetErrorMessage("Could not parse file");
+      return;
+    }
+
+    this->result = ReadAudioProperties(f);
+    this->HoldResult(ByteSize(this->result));
+  }
+
+  void HandleOKCallback() {
+    v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+    v8::Local<v8::Object> obj = MapToObject(this->result, context);
+    v8::Local<v8::Value> argv[2] = {
+      Nan::Null(),
+      obj
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  void HandleErrorCallback() {
+    v8::Local<v8::Value> argv[2] = {
+      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
+      Nan::Null()
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  private:
+    TagLib::Map<TagLib::String, TagLib::String> result;
+};
+
+class ReadId3TagsWorker : public JobWorker {
+  public:
+    ReadId3TagsWorker(Nan::Callback *callback, TagLib::String path, FileOptions options)
+      : JobWorker(callback, path, options) {}
+  ~ReadId3TagsWorker() { }
+
+  size_t ResultEstimate() const {
+    return resultEstimate;
+  }
+
+  void Execute() {
+    if (this->Cancelled()) {
+      return;
+    }
+
+    CancellableStream stream(StringToFileName(path), &control, true);
+    std::unique_ptr<TagLib::MPEG::File> f;
+    bool valid = OpenMpegFile(&stream, format, f);
+    if (this->Cancelled()) {
+      return;
+    }
+    if (!valid) {
+      this->SetErrorMessage("Could not parse file");
+      return;
+    }
+
+    this->result = ReadId3Tags(f.get());
+    this->HoldResult(ByteSize(this->result));
+  }
+
+  void HandleOKCallback() {
+    v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+    v8::Local<v8::Object> obj = MapToObject(this->result, context);
+    v8::Local<v8::Value> argv[2] = {
+      Nan::Null(),
+      obj
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  void HandleErrorCallback() {
+    v8::Local<v8::Value> argv[2] = {
+      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
+      Nan::Null()
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  private:
+    TagLib::Map<TagLib::String, TagLib::String> result;
+};
+
+class WriteTagsWorker : public JobWorker {
+  public:
+    WriteTagsWorker(Nan::Callback *callback, TagLib::String path, v8::Local<v8::Object> props, FileOptions options)
+      : JobWorker(callback, path, options) {
+      this->SaveToPersistent("props", props);
+    }
+  ~WriteTagsWorker() { }
+
+  void Prepare() {
+    Nan::HandleScope scope;
+    v8::Local<v8::Context> context = Nan::GetCurrentContext();
+    this->map = ObjectToPropertyMap(this->GetFromPersistent("props").As<v8::Object>(), context);
+  }
+
+  size_t InputBytes() const {
+    return ByteSize(this->map);
+  }
+
+  void Execute() {
+    if (this->Cancelled()) {
+      return;
+    }
+
+    CancellableStream stream(StringToFileName(path), &control, false);
+    TagLib::FileRef f = OpenFile(&stream, format, false);
+    if (this->Cancelled()) {
+      return;
+    }
+    if (f.isNull()) {
+      this->SetErrorMessage("Could not parse file");
+      return;
+    }
+
+    TagLib::PropertyMap existingProperties = ReadTags(f);
+    TagLib::PropertyMap newProperties = MergePropertyMaps(existingProperties, this->map);
+    stream.Commit();
+    WriteTags(f, newProperties);
+  }
+
+  void HandleOKCallback() {
+    v8::Local<v8::Value> argv[2] = {
+      Nan::Null(),
+      Nan::True()
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  void HandleErrorCallback() {
+    v8::Local<v8::Value> argv[2] = {
+      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
+      Nan::Null()
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  private:
+    TagLib::PropertyMap map;
+};
+
+class WriteId3TagsWorker : public JobWorker {
+  public:
+    WriteId3TagsWorker(Nan::Callback *callback, TagLib::String path, v8::Local<v8::Object> props, FileOptions options)
+      : JobWorker(callback, path, options) {
+      this->SaveToPersistent("props", props);
+    }
+  ~WriteId3TagsWorker() { }
+
+  void Prepare() {
+    Nan::HandleScope scope;
+    v8::Local<v8::Context> context = Nan::GetCurrentContext();
+    this->map = ObjectToMap(this->GetFromPersistent("props").As<v8::Object>(), context);
+  }
+
+  size_t InputBytes() const {
+    return ByteSize(this->map);
+  }
+
+  void Execute() {
+    if (this->Cancelled()) {
+      return;
+    }
+
+    CancellableStream stream(StringToFileName(path), &control, false);
+    std::unique_ptr<TagLib::MPEG::File> f;
+    bool valid = OpenMpegFile(&stream, format, f);
+    if (this->Cancelled()) {
+      return;
+    }
+    if (!valid) {
+      this->SetErrorMessage("Could not parse file");
+      return;
+    }
+
+    stream.Commit();
+    WriteId3Tags(f.get(), this->map);
+  }
+
+  void HandleOKCallback() {
+    v8::Local<v8::Value> argv[2] = {
+      Nan::Null(),
+      Nan::True()
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  void HandleErrorCallback() {
+    v8::Local<v8::Value> argv[2] = {
+      Nan::New<v8::String>(this->ErrorMessage()).ToLocalChecked(),
+      Nan::Null()
+    };
+
+    callback->Call(2, argv, async_resource);
+  }
+
+  private:
+    TagLib::Map<TagLib::String, TagLib::String> map;
+};
+
+#ifdef __linux__
+class Watcher;
+
+// active watchers by id, only touched from the main thread
+std::map<uint32_t, Watcher*> watchers;
+uint32_t nextWatchId = 1;
+
+// watches a directory tree with inotify and emits tag diffs of changed files
+// runs on its own thread so that it never occupies a slot of the libuv threadpool,
+// events are handed to the main thread through a uv_async_t
+class Watcher {
+  typedef std::chrono::steady_clock Clock;
+
+  // how often an indexed file which cannot be parsed is retried before it is left alone
+  static const int maxRetries = 5;
+
+  public:
+    Watcher(Nan::Callback *callback, uint32_t id, std::string root, int debounce, bool readAudioProperties, bool initial)
+      : callback(callback), resource("taglib3:watch"), id(id), root(root), debounce(debounce),
+        readAudioProperties(readAudioProperties), initial(initial), stopped(false), started(false), indexed(false), finished(false), ready(false) {
+      if (pipe2(wakeup, O_CLOEXEC | O_NONBLOCK) != 0) {
+        wakeup[0] = wakeup[1] = -1;
+      }
+      uv_mutex_init(&mutex);
+    }
+  ~Watcher() {
+    watchers.erase(id);
+    uv_mutex_destroy(&mutex);
+    if (wakeup[0] >= 0) {
+      close(wakeup[0]);
+      close(wakeup[1]);
+    }
+    delete callback;
+  }
+
+  void Start() {
+    uv_async_init(Nan::GetCurrentEventLoop(), &async, OnAsync);
+    async.data = this;
+    started = uv_thread_create(&thread, Main, this) == 0;
+    if (!started) {
+      Finish("Could not start the watch thread");
+    }
+  }
+
+  // called from the main thread, wakes up the watch thread
+  void Stop() {
+    stopped = true;
+    if (wakeup[1] >= 0) {
+      char c = 0;
+      if (write(wakeup[1], &c, 1) < 0) {
+        // the pipe is full, so a wakeup is already pending
+      }
+    }
+  }
+
+  private:
+    static void Main(void *arg) {
+      static_cast<Watcher*>(arg)->Run();
+    }
+
+    static void OnAsync(uv_async_t *handle) {
+      static_cast<Watcher*>(handle->data)->Deliver();
+    }
+
+    static void OnClose(uv_handle_t *handle) {
+      delete static_cast<Watcher*>(handle->data);
+    }
+
+    void Run() {
+      struct stat st;
+      if (stat(root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        Finish("Expected a directory");
+        return;
+      }
+
+      int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (fd < 0 || wakeup[0] < 0) {
+        if (fd >= 0) {
+          close(fd);
+        }
+        Finish("Could not initialize inotify");
+        return;
+      }
+
+      // build the initial index
+      std::vector<WatchEvent> events;
+      std::vector<std::string> files;
+      Scan(fd, root, files);
+      for (auto it = files.begin(); it != files.end() && !stopped; it++) {
+        Reindex(*it, events);
+      }
+      if (!initial) {
+        events.clear();
+      }
+      Flush(events);
+
+      uv_mutex_lock(&mutex);
+      indexed = true;
+      uv_mutex_unlock(&mutex);
+      uv_async_send(&async);
+
+      std::string error;
+      char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+      while (!stopped) {
+        struct pollfd fds[2] = {
+          { fd, POLLIN, 0 },
+          { wakeup[0], POLLIN, 0 }
+        };
+
+        if (poll(fds, 2, Timeout()) < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          error = "Could not poll inotify";
+          break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+          break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+          ssize_t length;
+          while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (char *ptr = buffer; ptr < buffer + length; ) {
+              const struct inotify_event *event = (const struct inotify_event *) ptr;
+              HandleEvent(fd, event);
+              ptr += sizeof(struct inotify_event) + event->len;
+            }
+          }
+        }
+
+        // re-parse files which have been quiet for the debounce interval
+        Clock::time_point now = Clock::now();
+        for (auto it = pending.begin(); it != pending.end(); ) {
+          if (it->second <= now) {
+            std::string path = it->first;
+            it = pending.erase(it);
+            Reindex(path, events);
+          } else {
+            it++;
+          }
+        }
+        Flush(events);
+      }
+
+      close(fd);
+      Finish(error);
+    }
+
+    // hand events to the main thread
+    void Flush(std::vector<WatchEvent> &events) {
+      if (!events.empty()) {
+        uv_mutex_lock(&mutex);
+        queue.insert(queue.end(), events.begin(), events.end());
+        uv_mutex_unlock(&mutex);
+        events.clear();
+        uv_async_send(&async);
+      }
+    }
+
+    // the watch thread is done, error is empty if it was stopped
+    void Finish(const std::string &error) {
+      uv_mutex_lock(&mutex);
+      this->error = error;
+      finished = true;
+      uv_mutex_unlock(&mutex);
+      uv_async_send(&async);
+    }
+
+    // main thread, calls back with the queued events, with true once the initial index is built
+    // and once more with null when finished
+    void Deliver() {
+      Nan::HandleScope scope;
+      v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+      std::vector<WatchEvent> events;
+      uv_mutex_lock(&mutex);
+      events.swap(queue);
+      bool done = finished;
+      bool announce = indexed && !ready;
+      std::string message = error;
+      uv_mutex_unlock(&mutex);
+
+      if (!events.empty()) {
+        v8::Local<v8::Array> array = Nan::New<v8::Array>(events.size());
+        for (size_t i = 0; i < events.size(); i++) {
+          array->Set(context, i, WatchEventToObject(events[i], context));
+        }
+
+        v8::Local<v8::Value> argv[2] = {
+          Nan::Null(),
+          array
+        };
+
+        callback->Call(2, argv, &resource);
+      }
+
+      if (announce) {
+        ready = true;
+        v8::Local<v8::Value> argv[2] = {
+          Nan::Null(),
+          Nan::True()
+        };
+
+        callback->Call(2, argv, &resource);
+      }
+
+      if (done && !uv_is_closing((uv_handle_t*) &async)) {
+        if (started) {
+          uv_thread_join(&thread);
+        }
+
+        v8::Local<v8::Value> argv[2] = {
+          message.empty() ? (v8::Local<v8::Value>) Nan::Null() : (v8::Local<v8::Value>) Nan::New<v8::String>(message).ToLocalChecked(),
+          Nan::Null()
+        };
+
+        callback->Call(2, argv, &resource);
+        uv_close((uv_handle_t*) &async, OnClose);
+      }
+    }
+
+    // watch a directory and its subdirectories, collecting all regular files
+    void Scan(int fd, const std::string &dir, std::vector<std::string> &files) {
+      int wd = inotify_add_watch(fd, dir.c_str(),
+        IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW);
+      if (wd < 0) {
+        return;
+      }
+      directories[wd] = dir;
+
+      DIR *d = opendir(dir.c_str());
+      if (d == nullptr) {
+        return;
+      }
+
+      struct dirent *entry;
+      while ((entry = readdir(d)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+          continue;
+        }
+
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+          continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+          Scan(fd, path, files);
+        } else if (S_ISREG(st.st_mode)) {
+          files.push_back(path);
+        }
+      }
+
+      closedir(d);
+    }
+
+    void HandleEvent(int fd, const struct inotify_event *event) {
+      if (event->mask & IN_Q_OVERFLOW) {
+        // events were lost, re-check everything we know of and look for new files
+        std::vector<std::string> files;
+        Scan(fd, root, files);
+        for (auto it = files.begin(); it != files.end(); it++) {
+          Touch(*it);
+        }
+        for (auto it = index.begin(); it != index.end(); it++) {
+          Touch(it->first);
+        }
+        return;
+      }
+
+      auto dir = directories.find(event->wd);
+      if (dir == directories.end()) {
+        return;
+      }
+      if (event->mask & IN_IGNORED) {
+        directories.erase(dir);
+        return;
+      }
+      if (event->len == 0) {
+        return;
+      }
+
+      std::string path = dir->second + "/" + event->name;
+
+      if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          std::vector<std::string> files;
+          Scan(fd, path, files);
+          for (auto it = files.begin(); it != files.end(); it++) {
+            Touch(*it);
+          }
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          std::string prefix = path + "/";
+          for (auto it = index.lower_bound(prefix); it != index.end() && it->first.compare(0, prefix.size(), prefix) == 0; it++) {
+            Touch(it->first);
+          }
+        }
+        return;
+      }
+
+      Touch(path);
+    }
+
+    // (re-)start the debounce timer of a file
+    void Touch(const std::string &path) {
+      pending[path] = Clock::now() + std::chrono::milliseconds(debounce);
+    }
+
+    // milliseconds until the next pending file is due, -1 if there is none
+    int Timeout() {
+      if (pending.empty()) {
+        return -1;
+      }
+
+      Clock::time_point next = pending.begin()->second;
+      for (auto it = pending.begin(); it != pending.end(); it++) {
+        if (it->second < next) {
+          next = it->second;
+        }
+      }
+
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+      return remaining > 0 ? (int) remaining + 1 : 0;
+    }
+
+    bool Snapshot(const std::string &path, TagSnapshot &snapshot) {
+      // read-only, a read-write open would raise IN_CLOSE_WRITE on close and re-trigger the watch
+      CancellableStream stream(path.c_str(), nullptr, true);
+      TagLib::FileRef f = OpenFile(&stream, TagLib::String(), readAudioProperties);
+      if (f.isNull()) {
+        return false;
+      }
+
+      snapshot.tags = ReadTags(f);
+      if (readAudioProperties && f.audioProperties() != nullptr) {
+        snapshot.audio = ReadAudioProperties(f);
+      }
+
+      return true;
+    }
+
+    void Reindex(const std::string &path, std::vector<WatchEvent> &events) {
+      auto known = index.find(path);
+
+      WatchEvent event;
+      event.path = TagLib::String(path, TagLib::String::UTF8);
+
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        // the file is gone
+        retries.erase(path);
+        if (known != index.end()) {
+          event.type = "removed";
+          events.push_back(event);
+          index.erase(known);
+        }
+        return;
+      }
+
+      TagSnapshot snapshot;
+      if (!Snapshot(path, snapshot)) {
+        // we do not take the file lock, so another tool may still be writing the file,
+        // keep the last snapshot and try again after the debounce interval
+        if (known != index.end() && ++retries[path] <= maxRetries) {
+          Touch(path);
+        } else {
+          retries.erase(path);
+        }
+        return;
+      }
+      retries.erase(path);
+
+      if (known == index.end()) {
+        event.type = "added";
+        DiffSnapshots(TagSnapshot(), snapshot, event);
+        events.push_back(event);
+      } else {
+        event.type = "changed";
+        if (DiffSnapshots(known->second, snapshot, event)) {
+          events.push_back(event);
+        }
+      }
+
+      index[path] = snapshot;
+    }
+
+    Nan::Callback *callback;
+    Nan::AsyncResource resource;
+    uint32_t id;
+    std::string root;
+    int debounce;
+    bool readAudioProperties;
+    bool initial;
+    std::atomic<bool> stopped;
+    bool started;
+    int wakeup[2];
+
+    uv_thread_t thread;
+    uv_async_t async;
+
+    // guarded by the mutex
+    uv_mutex_t mutex;
+    std::vector<WatchEvent> queue;
+    std::string error;
+    bool indexed;
+    bool finished;
+
+    // only accessed from the main thread
+    bool ready;
+
+    // only accessed from the watch thread
+    std::map<int, std::string> directories;
+    std::map<std::string, TagSnapshot> index;
+    std::map<std::string, Clock::time_point> pending;
+    std::map<std::string, int> retries;
+};
+#endif
+
+NAN_METHOD(writeTags) {
+  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+  if (info.Length() != 4) {
+    Nan::ThrowTypeError("Expected 4 arguments");
+    return;
+  }
+
+  if (!ValidatePath(info[0])
+      || !ValidateProperties(info[1])
+      || !ValidateProperties(info[2])
+      || !ValidateCallback(info[3])) {
+    return;
+  }
+
+  v8::Local<v8::String> opt_path = info[0].As<v8::String>();
+  v8::Local<v8::Object> opt_props = info[1].As<v8::Object>();
+  v8::Local<v8::Object> opt_options = info[2].As<v8::Object>();
+  v8::Local<v8::Function> opt_callback = info[3].As<v8::Function>();
+
+  TagLib::String path = StringToTagLibString(opt_path);
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
+
+  Nan::Callback *callback = new Nan::Callback(opt_callback);
+  WriteTagsWorker *worker = new WriteTagsWorker(callback, path, opt_props, options);
+  info.GetReturnValue().Set(worker->Id());
+  SubmitJob(worker);
+}
+
+NAN_METHOD(writeTagsSync) {
+  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+  if (info.Length() != 3) {
+    Nan::ThrowTypeError("Expected 3 arguments");
+    return;
+  }
+
+  if (!ValidatePath(info[0])
+      || !ValidateProperties(info[1])
+      || !ValidateProperties(info[2])) {
+    return;
+  }
+
+  v8::Local<v8::String> opt_path = info[0].As<v8::String>();
+  v8::Local<v8::Object> opt_props = info[1].As<v8::Object>();
+  v8::Local<v8::Object> opt_options = info[2].As<v8::Object>();
+
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   TagLib::String path = StringToTagLibString(opt_path);
-  TagLib::FileRef f(StringToFileName(path), false);
+  CancellableStream stream(StringToFileName(path), nullptr, false);
+  TagLib::FileRef f = OpenFile(&stream, options.format, false);
   if (!ValidateFile(f)) {
     return;
   }
@@ -524,51 +2051,68 @@ NAN_METHOD(writeTagsSync) {
 NAN_METHOD(writeId3Tags) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
 
-  if (info.Length() != 3) {
-    Nan::ThrowTypeError("Expected 3 arguments");
+  if (info.Length() != 4) {
+    Nan::ThrowTypeError("Expected 4 arguments");
     return;
   }
 
   if (!ValidatePath(info[0])
       || !ValidateProperties(info[1])
-      || !ValidateCallback(info[2])) {
+      || !ValidateProperties(info[2])
+      || !ValidateCallback(info[3])) {
     return;
   }
 
   v8::Local<v8::String> opt_path = info[0].As<v8::String>();
   v8::Local<v8::Object> opt_props = info[1].As<v8::Object>();
-  v8::Local<v8::Function> opt_callback = info[2].As<v8::Function>();
+  v8::Local<v8::Object> opt_options = info[2].As<v8::Object>();
+  v8::Local<v8::Function> opt_callback = info[3].As<v8::Function>();
 
   TagLib::String path = StringToTagLibString(opt_path);
-  TagLib::Map<TagLib::String, TagLib::String> map = ObjectToMap(opt_props, context);
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   Nan::Callback *callback = new Nan::Callback(opt_callback);
-  AsyncQueueWorker(new WriteId3TagsWorker(callback, path, map));
+  WriteId3TagsWorker *worker = new WriteId3TagsWorker(callback, path, opt_props, options);
+  info.GetReturnValue().Set(worker->Id());
+  SubmitJob(worker);
 }
 
 NAN_METHOD(writeId3TagsSync) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
 
-  if (info.Length() != 2) {
-    Nan::ThrowTypeError("Expected 2 arguments");
+  if (info.Length() != 3) {
+    Nan::ThrowTypeError("Expected 3 arguments");
     return;
   }
 
-  if (!ValidatePath(info[0]) || !ValidateProperties(info[1])) {
+  if (!ValidatePath(info[0])
+      || !ValidateProperties(info[1])
+      || !ValidateProperties(info[2])) {
     return;
   }
 
   v8::Local<v8::String> opt_path = info[0].As<v8::String>();
   v8::Local<v8::Object> opt_props = info[1].As<v8::Object>();
+  v8::Local<v8::Object> opt_options = info[2].As<v8::Object>();
+
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   TagLib::String path = StringToTagLibString(opt_path);
-  TagLib::FileRef f(StringToFileName(path), false);
-  if (!ValidateFile(f)) {
+  CancellableStream stream(StringToFileName(path), nullptr, false);
+  std::unique_ptr<TagLib::MPEG::File> f;
+  if (!OpenMpegFile(&stream, options.format, f)) {
+    Nan::ThrowTypeError("Could not parse file");
     return;
   }
 
   TagLib::Map<TagLib::String, TagLib::String> map = ObjectToMap(opt_props, context);
-  WriteId3Tags(f, map);
+  WriteId3Tags(f.get(), map);
 
   info.GetReturnValue().Set(Nan::True());
 }
@@ -576,41 +2120,57 @@ NAN_METHOD(writeId3TagsSync) {
 NAN_METHOD(readTags) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
 
-  if (info.Length() != 2) {
-    Nan::ThrowTypeError("Expected 2 arguments");
+  if (info.Length() != 3) {
+    Nan::ThrowTypeError("Expected 3 arguments");
     return;
   }
 
-  if (!ValidatePath(info[0]) || !ValidateCallback(info[1])) {
+  if (!ValidatePath(info[0])
+      || !ValidateProperties(info[1])
+      || !ValidateCallback(info[2])) {
     return;
   }
 
   v8::Local<v8::String> opt_path = info[0].As<v8::String>();
-  v8::Local<v8::Function> opt_callback = info[1].As<v8::Function>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+  v8::Local<v8::Function> opt_callback = info[2].As<v8::Function>();
 
   TagLib::String path = StringToTagLibString(opt_path);
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   Nan::Callback *callback = new Nan::Callback(opt_callback);
-  AsyncQueueWorker(new ReadTagsWorker(callback, path));
+  ReadTagsWorker *worker = new ReadTagsWorker(callback, path, options);
+  info.GetReturnValue().Set(worker->Id());
+  SubmitJob(worker);
 }
 
 NAN_METHOD(readTagsSync) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
 
-  if (info.Length() != 1) {
-    Nan::ThrowTypeError("Expected 1 argument");
+  if (info.Length() != 2) {
+    Nan::ThrowTypeError("Expected 2 arguments");
     return;
   }
 
-  if (!ValidatePath(info[0])) {
+  if (!ValidatePath(info[0]) || !ValidateProperties(info[1])) {
     return;
   }
 
   v8::Local<v8::String> opt_path = info[0].As<v8::String>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   TagLib::String path = StringToTagLibString(opt_path);
 
-  TagLib::FileRef f(StringToFileName(path), false);
+  CancellableStream stream(StringToFileName(path), nullptr, true);
+  TagLib::FileRef f = OpenFile(&stream, options.format, false);
   if (!ValidateFile(f)) {
     return;
   }
@@ -621,23 +2181,94 @@ NAN_METHOD(readTagsSync) {
   info.GetReturnValue().Set(obj);
 }
 
+NAN_METHOD(readTagsBounded) {
+  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+  if (info.Length() != 3) {
+    Nan::ThrowTypeError("Expected 3 arguments");
+    return;
+  }
+
+  if (!ValidatePath(info[0])
+      || !ValidateProperties(info[1])
+      || !ValidateCallback(info[2])) {
+    return;
+  }
+
+  v8::Local<v8::String> opt_path = info[0].As<v8::String>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+  v8::Local<v8::Function> opt_callback = info[2].As<v8::Function>();
+
+  TagLib::String path = StringToTagLibString(opt_path);
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
+
+  Nan::Callback *callback = new Nan::Callback(opt_callback);
+  ReadTagsBoundedWorker *worker = new ReadTagsBoundedWorker(callback, path, options);
+  info.GetReturnValue().Set(worker->Id());
+  SubmitJob(worker);
+}
+
+NAN_METHOD(readTagsBoundedSync) {
+  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+  if (info.Length() != 2) {
+    Nan::ThrowTypeError("Expected 2 arguments");
+    return;
+  }
+
+  if (!ValidatePath(info[0]) || !ValidateProperties(info[1])) {
+    return;
+  }
+
+  v8::Local<v8::String> opt_path = info[0].As<v8::String>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
+
+  TagLib::String path = StringToTagLibString(opt_path);
+
+  CancellableStream stream(StringToFileName(path), nullptr, true);
+  TagLib::PropertyMap map;
+  if (!ReadBoundedTags(&stream, options.format, map)) {
+    Nan::ThrowTypeError("Could not parse file");
+    return;
+  }
+
+  v8::Local<v8::Object> obj = BoundedResultToObject(map, stream.BytesRead(), stream.Seeks(), context);
+
+  info.GetReturnValue().Set(obj);
+}
+
 NAN_METHOD(readAudioPropertiesSync) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
 
-  if (info.Length() != 1) {
-    Nan::ThrowTypeError("Expected 1 argument");
+  if (info.Length() != 2) {
+    Nan::ThrowTypeError("Expected 2 arguments");
     return;
   }
 
-  if (!ValidatePath(info[0])) {
+  if (!ValidatePath(info[0]) || !ValidateProperties(info[1])) {
     return;
   }
 
   v8::Local<v8::String> opt_path = info[0].As<v8::String>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   TagLib::String path = StringToTagLibString(opt_path);
 
-  TagLib::FileRef f(StringToFileName(path), true, TagLib::AudioProperties::Fast);
+  CancellableStream stream(StringToFileName(path), nullptr, true);
+  TagLib::FileRef f = OpenFile(&stream, options.format, true);
   if (!ValidateFile(f)) {
     return;
   }
@@ -651,72 +2282,218 @@ NAN_METHOD(readAudioPropertiesSync) {
 NAN_METHOD(readAudioProperties) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
 
-  if (info.Length() != 2) {
-    Nan::ThrowTypeError("Expected 2 arguments");
+  if (info.Length() != 3) {
+    Nan::ThrowTypeError("Expected 3 arguments");
     return;
   }
 
-  if (!ValidatePath(info[0]) || !ValidateCallback(info[1])) {
+  if (!ValidatePath(info[0])
+      || !ValidateProperties(info[1])
+      || !ValidateCallback(info[2])) {
     return;
   }
 
   v8::Local<v8::String> opt_path = info[0].As<v8::String>();
-  v8::Local<v8::Function> opt_callback = info[1].As<v8::Function>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+  v8::Local<v8::Function> opt_callback = info[2].As<v8::Function>();
 
   TagLib::String path = StringToTagLibString(opt_path);
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   Nan::Callback *callback = new Nan::Callback(opt_callback);
-  AsyncQueueWorker(new ReadAudioPropertiesWorker(callback, path));
+  ReadAudioPropertiesWorker *worker = new ReadAudioPropertiesWorker(callback, path, options);
+  info.GetReturnValue().Set(worker->Id());
+  SubmitJob(worker);
 }
 
 NAN_METHOD(readId3Tags) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
 
-  if (info.Length() != 2) {
-    Nan::ThrowTypeError("Expected 2 arguments");
+  if (info.Length() != 3) {
+    Nan::ThrowTypeError("Expected 3 arguments");
     return;
   }
 
-  if (!ValidatePath(info[0]) || !ValidateCallback(info[1])) {
+  if (!ValidatePath(info[0])
+      || !ValidateProperties(info[1])
+      || !ValidateCallback(info[2])) {
     return;
   }
 
   v8::Local<v8::String> opt_path = info[0].As<v8::String>();
-  v8::Local<v8::Function> opt_callback = info[1].As<v8::Function>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+  v8::Local<v8::Function> opt_callback = info[2].As<v8::Function>();
 
   TagLib::String path = StringToTagLibString(opt_path);
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   Nan::Callback *callback = new Nan::Callback(opt_callback);
-  AsyncQueueWorker(new ReadId3TagsWorker(callback, path));
+  ReadId3TagsWorker *worker = new ReadId3TagsWorker(callback, path, options);
+  info.GetReturnValue().Set(worker->Id());
+  SubmitJob(worker);
 }
 
 NAN_METHOD(readId3TagsSync) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
 
-  if (info.Length() != 1) {
-    Nan::ThrowTypeError("Expected 1 argument");
+  if (info.Length() != 2) {
+    Nan::ThrowTypeError("Expected 2 arguments");
     return;
   }
 
-  if (!ValidatePath(info[0])) {
+  if (!ValidatePath(info[0]) || !ValidateProperties(info[1])) {
     return;
   }
 
   v8::Local<v8::String> opt_path = info[0].As<v8::String>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+
+  FileOptions options;
+  if (!ParseFileOptions(opt_options, context, options)) {
+    return;
+  }
 
   TagLib::String path = StringToTagLibString(opt_path);
 
-  TagLib::FileRef f(StringToFileName(path), false);
-  if (!ValidateFile(f)) {
+  CancellableStream stream(StringToFileName(path), nullptr, true);
+  std::unique_ptr<TagLib::MPEG::File> f;
+  if (!OpenMpegFile(&stream, options.format, f)) {
+    Nan::ThrowTypeError("Could not parse file");
     return;
   }
-  TagLib::Map<TagLib::String, TagLib::String> map = ReadId3Tags(f);
+  TagLib::Map<TagLib::String, TagLib::String> map = ReadId3Tags(f.get());
 
   v8::Local<v8::Object> obj = MapToObject(map, context);
 
   info.GetReturnValue().Set(obj);
 }
 
+NAN_METHOD(abortJob) {
+  if (info.Length() != 1) {
+    Nan::ThrowTypeError("Expected 1 argument");
+    return;
+  }
+
+  if (!info[0]->IsNumber()) {
+    Nan::ThrowTypeError("Expected a number");
+    return;
+  }
+
+  uint32_t id = Nan::To<uint32_t>(info[0]).FromJust();
+  auto it = jobs.find(id);
+  if (it != jobs.end()) {
+    it->second->Abort();
+    PumpJobs();
+  }
+}
+
+NAN_METHOD(setLimits) {
+  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+  if (info.Length() != 1) {
+    Nan::ThrowTypeError("Expected 1 argument");
+    return;
+  }
+
+  if (!ValidateProperties(info[0])) {
+    return;
+  }
+
+  v8::Local<v8::Object> opt_limits = info[0].As<v8::Object>();
+  v8::Local<v8::Value> opt_jobs = opt_limits->Get(context, Nan::New("maxJobs").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> opt_bytes = opt_limits->Get(context, Nan::New("maxBytes").ToLocalChecked()).ToLocalChecked();
+
+  if (opt_jobs->IsNumber()) {
+    double jobs = Nan::To<double>(opt_jobs).FromJust();
+    admission.maxJobs = jobs > 0 ? (size_t) jobs : 0;
+  }
+  if (opt_bytes->IsNumber()) {
+    double bytes = Nan::To<double>(opt_bytes).FromJust();
+    admission.maxBytes = bytes > 0 ? (size_t) bytes : 0;
+  }
+
+  PumpJobs();
+}
+
+NAN_METHOD(getUsage) {
+  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+  v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+  obj->Set(context, Nan::New("jobs").ToLocalChecked(), Nan::New<v8::Number>((double) admission.jobs));
+  obj->Set(context, Nan::New("bytes").ToLocalChecked(), Nan::New<v8::Number>((double) admission.bytes));
+  obj->Set(context, Nan::New("queued").ToLocalChecked(), Nan::New<v8::Number>((double) admission.queue.size()));
+  obj->Set(context, Nan::New("maxJobs").ToLocalChecked(), Nan::New<v8::Number>((double) admission.maxJobs));
+  obj->Set(context, Nan::New("maxBytes").ToLocalChecked(), Nan::New<v8::Number>((double) admission.maxBytes));
+
+  info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(watch) {
+  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+
+  if (info.Length() != 3) {
+    Nan::ThrowTypeError("Expected 3 arguments");
+    return;
+  }
+
+  if (!ValidatePath(info[0])
+      || !ValidateProperties(info[1])
+      || !ValidateCallback(info[2])) {
+    return;
+  }
+
+#ifdef __linux__
+  v8::Local<v8::String> opt_root = info[0].As<v8::String>();
+  v8::Local<v8::Object> opt_options = info[1].As<v8::Object>();
+  v8::Local<v8::Function> opt_callback = info[2].As<v8::Function>();
+
+  v8::Local<v8::Value> opt_debounce = opt_options->Get(context, Nan::New("debounce").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> opt_audio = opt_options->Get(context, Nan::New("readAudioProperties").ToLocalChecked()).ToLocalChecked();
+  v8::Local<v8::Value> opt_initial = opt_options->Get(context, Nan::New("initial").ToLocalChecked()).ToLocalChecked();
+
+  std::string root = *Nan::Utf8String(opt_root);
+  int debounce = opt_debounce->IsNumber() ? Nan::To<int32_t>(opt_debounce).FromJust() : 200;
+  bool readAudioProperties = opt_audio->IsTrue();
+  bool initial = opt_initial->IsTrue();
+
+  uint32_t id = nextWatchId++;
+  Nan::Callback *callback = new Nan::Callback(opt_callback);
+  Watcher *watcher = new Watcher(callback, id, root, debounce < 0 ? 0 : debounce, readAudioProperties, initial);
+  watchers[id] = watcher;
+  watcher->Start();
+
+  info.GetReturnValue().Set(id);
+#else
+  Nan::ThrowError("watch is only supported on Linux");
+#endif
+}
+
+NAN_METHOD(unwatch) {
+  if (info.Length() != 1) {
+    Nan::ThrowTypeError("Expected 1 argument");
+    return;
+  }
+
+  if (!info[0]->IsNumber()) {
+    Nan::ThrowTypeError("Expected a number");
+    return;
+  }
+
+#ifdef __linux__
+  uint32_t id = Nan::To<uint32_t>(info[0]).FromJust();
+  auto it = watchers.find(id);
+  if (it != watchers.end()) {
+    it->second->Stop();
+  }
+#endif
+}
+
 void Init(v8::Local<v8::Object> exports, v8::Local<v8::Value> module, void *) {
   v8::Local<v8::Context> context = Nan::GetCurrentContext();
   exports->Set(context,
@@ -744,6 +2521,14 @@ void Init(v8::Local<v8::Object> exports, v8::Local<v8::Value> module, void *) {
     Nan::New("readTags").ToLocalChecked(),
     Nan::New<v8::FunctionTemplate>(readTags)->GetFunction(context).ToLocalChecked()
   );
+  exports->Set(context,
+    Nan::New("readTagsBoundedSync").ToLocalChecked(),
+    Nan::New<v8::FunctionTemplate>(readTagsBoundedSync)->GetFunction(context).ToLocalChecked()
+  );
+  exports->Set(context,
+    Nan::New("readTagsBounded").ToLocalChecked(),
+    Nan::New<v8::FunctionTemplate>(readTagsBounded)->GetFunction(context).ToLocalChecked()
+  );
   exports->Set(context,
     Nan::New("readId3TagsSync").ToLocalChecked(),
     Nan::New<v8::FunctionTemplate>(readId3TagsSync)->GetFunction(context).ToLocalChecked()
@@ -761,6 +2546,29 @@ void Init(v8::Local<v8::Object> exports, v8::Local<v8::Value> module, void *) {
     Nan::New("readAudioProperties").ToLocalChecked(),
     Nan::New<v8::FunctionTemplate>(readAudioProperties)->GetFunction(context).ToLocalChecked()
   );
+
+  exports->Set(context,
+    Nan::New("abort").ToLocalChecked(),
+    Nan::New<v8::FunctionTemplate>(abortJob)->GetFunction(context).ToLocalChecked()
+  );
+
+  exports->Set(context,
+    Nan::New("setLimits").ToLocalChecked(),
+    Nan::New<v8::FunctionTemplate>(setLimits)->GetFunction(context).ToLocalChecked()
+  );
+  exports->Set(context,
+    Nan::New("getUsage").ToLocalChecked(),
+    Nan::New<v8::FunctionTemplate>(getUsage)->GetFunction(context).ToLocalChecked()
+  );
+
+  exports->Set(context,
+    Nan::New("watch").ToLocalChecked(),
+    Nan::New<v8::FunctionTemplate>(watch)->GetFunction(context).ToLocalChecked()
+  );
+  exports->Set(context,
+    Nan::New("unwatch").ToLocalChecked(),
+    Nan::New<v8::FunctionTemplate>(unwatch)->GetFunction(context).ToLocalChecked()
+  );
 }
 
 NODE_MODULE(taglib3, Init)
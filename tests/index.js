@@ -1,6 +1,7 @@
 'use strict'
 const fs = require('fs')
 const taglib3 = require('../index')
+const binding = require('../build/Release/taglib3.node')
 const test = require('tape')
 const path = require('path')
 const http = require('http')
@@ -36,3 +37,296 @@ test('sync write/read', assert => {
 
   assert.end()
 })
+
+test('bounded read', assert => {
+  const audiopath = FIXTURES_PATH + '/sample-output å æ ø ö ä ù ó ð ✔️.mp3'
+  const size = fs.statSync(audiopath).size
+
+  const result = taglib3.readTagsBoundedSync(audiopath)
+  assert.deepEqual(result.tags, taglib3.readTagsSync(audiopath))
+  assert.ok(result.io.bytesRead > 0)
+  assert.ok(result.io.bytesRead < size)
+  assert.ok(result.io.seeks > 0)
+
+  // sample.mp3 has a 3665 byte ID3v2 tag and no footer tags: the sniffing windows at 0 and
+  // behind the tag, the tag body and the 160 byte footer window
+  const sample = FIXTURES_PATH + '/sample.mp3'
+  assert.deepEqual(taglib3.readTagsBoundedSync(sample).io, { bytesRead: 64 + 64 + 3655 + 160, seeks: 4 })
+
+  taglib3.readTagsBounded(sample, { format: 'mpeg' }, (error, data) => {
+    assert.equal(error, null)
+    assert.deepEqual(data.tags, taglib3.readTagsSync(sample))
+    // with a hint only the ID3v2 header is read up front
+    assert.deepEqual(data.io, { bytesRead: 10 + 3655 + 160, seeks: 3 })
+
+    // footer tags are parsed from the 160 byte window, only the APE items in front of it are read
+    const dir = fs.mkdtempSync(path.join(FIXTURES_PATH, 'footer-'))
+    const tagged = path.join(dir, 'sample.mp3')
+    const item = Buffer.concat([Buffer.alloc(8), Buffer.from('Title\0ape', 'latin1')])
+    item.writeUInt32LE(3, 0)
+    const ape = Buffer.alloc(32)
+    ape.write('APETAGEX', 0, 'latin1')
+    ape.writeUInt32LE(2000, 8)
+    ape.writeUInt32LE(item.length + 32, 12)
+    ape.writeUInt32LE(1, 16)
+    const id3v1 = Buffer.alloc(128)
+    id3v1.write('TAGid3v1', 0, 'latin1')
+    fs.writeFileSync(tagged, Buffer.concat([fs.readFileSync(sample), item, ape, id3v1]))
+
+    const footer = taglib3.readTagsBoundedSync(tagged, { format: 'mpeg' })
+    assert.deepEqual(footer.tags, data.tags)
+    assert.deepEqual(footer.io, { bytesRead: 10 + 3655 + 160 + item.length, seeks: 4 })
+
+    fs.unlinkSync(tagged)
+    fs.rmdirSync(dir)
+    assert.end()
+  })
+})
+
+test('format hint and sniffing', assert => {
+  const audiopath = FIXTURES_PATH + '/sample.mp3'
+
+  const hinted = taglib3.readAudioPropertiesSync(audiopath, { format: 'mpeg' })
+  assert.equal(hinted.length, '90')
+
+  assert.throws(() => {
+    taglib3.readTagsSync(audiopath, { format: 'flac' })
+  }, 'wrong format hint')
+
+  assert.throws(() => {
+    taglib3.readTagsSync(audiopath, { format: 'nope' })
+  }, 'unknown format hint')
+
+  // sniffing does not rely on the extension
+  const dir = fs.mkdtempSync(path.join(FIXTURES_PATH, 'sniff-'))
+  const renamed = path.join(dir, 'sample.bin')
+  fs.writeFileSync(renamed, fs.readFileSync(audiopath))
+  assert.equal(taglib3.readAudioPropertiesSync(renamed).length, '90')
+
+  const text = path.join(dir, 'text.mp3')
+  fs.writeFileSync(text, 'not an mp3 file')
+  assert.throws(() => {
+    taglib3.readTagsSync(text)
+  }, 'unrecognized file')
+
+  // a minimal Scream Tracker 3 module, recognized by the SCRM signature at offset 44
+  const module = path.join(dir, 'module.bin')
+  const s3m = Buffer.alloc(1024)
+  s3m.write('sniffed s3m', 0, 'latin1')
+  s3m[28] = 0x1a
+  s3m[29] = 0x10
+  s3m.writeUInt16LE(0x1320, 40)
+  s3m.writeUInt16LE(2, 42)
+  s3m.write('SCRM', 44, 'latin1')
+  s3m[48] = 64
+  s3m[49] = 6
+  s3m[50] = 125
+  s3m[51] = 0xb0
+  s3m.fill(0xff, 72, 96)
+  fs.writeFileSync(module, s3m)
+  assert.deepEqual(taglib3.readTagsSync(module).TITLE, ['sniffed s3m'])
+
+  fs.unlinkSync(renamed)
+  fs.unlinkSync(text)
+  fs.unlinkSync(module)
+  fs.rmdirSync(dir)
+  assert.end()
+})
+
+test('abort and timeout', { skip: typeof AbortController === 'undefined' }, assert => {
+  const audiopath = FIXTURES_PATH + '/sample.mp3'
+  const controller = new AbortController()
+  controller.abort()
+
+  taglib3.readTags(audiopath, { signal: controller.signal }, (error, data) => {
+    assert.equal(error, 'Operation aborted')
+    assert.equal(data, undefined)
+
+    taglib3.readTags(audiopath, { timeout: 60000 }, (error, data) => {
+      assert.equal(error, null)
+      assert.equal(typeof data, 'object')
+      assert.end()
+    })
+  })
+})
+
+test('abort and expire queued native jobs', assert => {
+  const audiopath = FIXTURES_PATH + '/sample.mp3'
+
+  // keep the only slot busy, so that the following jobs wait in the native queue
+  taglib3.setLimits({ maxJobs: 1 })
+  const results = []
+  const job = (start) => new Promise(resolve => start((error, data) => resolve({ error, data })))
+
+  results.push(job(cb => binding.readTags(audiopath, {}, cb)))
+  results.push(job(cb => binding.abort(binding.readTags(audiopath, {}, cb))))
+  results.push(job(cb => binding.readTags(audiopath, { timeout: 1 }, cb)))
+
+  // make sure the deadline has passed before the blocking job can complete
+  const start = Date.now()
+  while (Date.now() - start < 5) {}
+
+  Promise.all(results).then(([blocker, aborted, expired]) => {
+    assert.equal(blocker.error, null)
+    assert.equal(aborted.error, 'Operation aborted')
+    assert.equal(expired.error, 'Operation timed out')
+    taglib3.setLimits({ maxJobs: 0 })
+    assert.end()
+  })
+})
+
+test('aborted write keeps the file intact', assert => {
+  const dir = fs.mkdtempSync(path.join(FIXTURES_PATH, 'abort-'))
+  const audiopath = path.join(dir, 'sample.mp3')
+  fs.writeFileSync(audiopath, fs.readFileSync(FIXTURES_PATH + '/sample.mp3'))
+  taglib3.writeTagsSync(audiopath, { title: ['before'] })
+
+  taglib3.setLimits({ maxJobs: 1 })
+  binding.readTags(audiopath, {}, () => {})
+  const id = binding.writeTags(audiopath, { title: ['after'] }, {}, (error, data) => {
+    assert.equal(error, 'Operation aborted')
+    assert.deepEqual(taglib3.readTagsSync(audiopath).TITLE, ['before'])
+
+    taglib3.setLimits({ maxJobs: 0 })
+    fs.unlinkSync(audiopath)
+    fs.rmdirSync(dir)
+    assert.end()
+  })
+  binding.abort(id)
+})
+
+test('aborted write reports its real outcome', { skip: typeof AbortController === 'undefined' }, assert => {
+  const dir = fs.mkdtempSync(path.join(FIXTURES_PATH, 'outcome-'))
+  const audiopath = path.join(dir, 'sample.mp3')
+  fs.writeFileSync(audiopath, fs.readFileSync(FIXTURES_PATH + '/sample.mp3'))
+  taglib3.writeTagsSync(audiopath, { title: ['before'] })
+
+  // the abort may land before or after the save has started, the callback has to agree with the file
+  const controller = new AbortController()
+  taglib3.writeTags(audiopath, { title: ['after'] }, { signal: controller.signal }, (error, data) => {
+    const title = taglib3.readTagsSync(audiopath).TITLE
+    if (error) {
+      assert.equal(error, 'Operation aborted')
+      assert.deepEqual(title, ['before'])
+    } else {
+      assert.equal(data, true)
+      assert.deepEqual(title, ['after'])
+    }
+
+    fs.unlinkSync(audiopath)
+    fs.rmdirSync(dir)
+    assert.end()
+  })
+  setImmediate(() => controller.abort())
+})
+
+test('promises with limits', async assert => {
+  // distinct files, so that the JS file lock does not hold calls back before the native queue
+  const dir = fs.mkdtempSync(path.join(FIXTURES_PATH, 'limits-'))
+  const sample = fs.readFileSync(FIXTURES_PATH + '/sample.mp3')
+  const copies = []
+  for (let i = 0; i < 8; i++) {
+    copies.push(path.join(dir, 'sample-' + i + '.mp3'))
+    fs.writeFileSync(copies[i], sample)
+  }
+
+  taglib3.setLimits({ maxJobs: 2, maxBytes: 1024 * 1024 })
+
+  const pending = copies.map(audiopath => taglib3.promises.readAudioProperties(audiopath))
+  let usage = taglib3.getUsage()
+  assert.equal(usage.jobs, 2)
+  assert.ok(usage.queued > 0)
+
+  const results = await Promise.all(pending)
+  results.forEach(props => assert.equal(props.length, '90'))
+
+  // jobs are released after their callback has returned
+  await new Promise(resolve => setImmediate(resolve))
+  usage = taglib3.getUsage()
+  assert.equal(usage.jobs, 0)
+  assert.equal(usage.bytes, 0)
+  assert.equal(usage.queued, 0)
+
+  // the first write holds more than maxBytes, the others wait for it
+  taglib3.setLimits({ maxJobs: 0, maxBytes: 1 })
+  const writes = copies.map(audiopath => taglib3.promises.writeTags(audiopath, { title: ['limited title'] }))
+  usage = taglib3.getUsage()
+  assert.equal(usage.jobs, 1)
+  assert.ok(usage.bytes > 1)
+  assert.equal(usage.queued, copies.length - 1)
+
+  await Promise.all(writes)
+  await new Promise(resolve => setImmediate(resolve))
+  usage = taglib3.getUsage()
+  assert.equal(usage.jobs, 0)
+  assert.equal(usage.bytes, 0)
+  assert.equal(usage.queued, 0)
+  copies.forEach(audiopath => assert.deepEqual(taglib3.readTagsSync(audiopath).TITLE, ['limited title']))
+
+  try {
+    await taglib3.promises.readTags(FIXTURES_PATH + '/missing.mp3')
+    assert.fail('expected a rejection')
+  } catch (error) {
+    assert.ok(error instanceof Error)
+  }
+
+  taglib3.setLimits({ maxJobs: 0, maxBytes: 0 })
+  copies.forEach(audiopath => fs.unlinkSync(audiopath))
+  fs.rmdirSync(dir)
+  assert.end()
+})
+
+test('maxBytes holds back reads', assert => {
+  const audiopath = FIXTURES_PATH + '/sample.mp3'
+  taglib3.setLimits({ maxJobs: 0, maxBytes: 1 })
+
+  // straight to the binding, the JS file lock would serialize calls on the same file
+  const reads = []
+  for (let i = 0; i < 8; i++) {
+    reads.push(new Promise(resolve => binding.readTags(audiopath, {}, (error, data) => resolve({ error, data }))))
+  }
+  const usage = taglib3.getUsage()
+  assert.equal(usage.jobs, 1)
+  assert.ok(usage.queued > 0)
+
+  Promise.all(reads).then(results => {
+    results.forEach(result => assert.equal(result.error, null))
+    setImmediate(() => {
+      const usage = taglib3.getUsage()
+      assert.equal(usage.jobs, 0)
+      assert.equal(usage.bytes, 0)
+      taglib3.setLimits({ maxJobs: 0, maxBytes: 0 })
+      assert.end()
+    })
+  })
+})
+
+test('watch', { skip: process.platform !== 'linux' }, assert => {
+  const dir = fs.mkdtempSync(path.join(FIXTURES_PATH, 'watch-'))
+  const audiopath = path.join(dir, 'sample.mp3')
+  fs.writeFileSync(audiopath, fs.readFileSync(FIXTURES_PATH + '/sample.mp3'))
+
+  const watcher = taglib3.watch(dir, { debounce: 50 })
+  watcher.on('error', error => assert.fail(error))
+
+  watcher.once('change', event => {
+    assert.equal(event.path, audiopath)
+    assert.equal(event.type, 'changed')
+    const title = Object.assign({}, event.added, event.changed).TITLE
+    assert.deepEqual(title, ['watched title'])
+
+    watcher.once('change', event => {
+      assert.equal(event.type, 'removed')
+      watcher.close()
+    })
+    fs.unlinkSync(audiopath)
+  })
+
+  watcher.on('close', () => {
+    fs.rmdirSync(dir)
+    assert.end()
+  })
+
+  // changes are diffed against the initial index once it is built
+  watcher.once('ready', () => taglib3.writeTagsSync(audiopath, { title: ['watched title'] }))
+})